@@ -0,0 +1,300 @@
+// QPS and latency percentiles of PgConnection::exec against a throwaway local server:
+// initdb and pg_ctl into a temporary directory, a synthetic schema, then each workload for
+// a fixed time. Results are appended to a JSON or CSV file for comparing library versions.
+//
+// g++ -std=c++17 -O2 -I.. end_to_end.cpp $(pkg-config --cflags --libs Qt5Core libpq) -pthread -fPIC
+// ./a.out --bindir /usr/lib/postgresql/16/bin --seconds 10 --threads 16 --label v1.2 --out results.json
+//
+// Workloads:
+//   point_select   SELECT of one row by primary key
+//   small_insert   INSERT of one short row
+//   wide_fetch     100 rows of 20 columns, every value decoded
+//   bytea_blob     one 64 KB bytea by primary key
+//   contention     point_select from --threads threads through a PgPool of threads / 4 connections
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+#include "../t_pg_pool.h"
+
+struct Args {
+	QString bindir;
+	QString label = "t_pg";
+	QString out = "end_to_end.json";
+	int seconds = 10;
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 2U);
+	int port = 54329;
+};
+
+struct Result {
+	QString workload;
+	unsigned threads;
+	uint64_t ops;
+	uint64_t errors;
+	double qps;
+	double p50us;
+	double p95us;
+	double p99us;
+	double p999us;
+	double maxUs;
+};
+
+// initdb, pg_ctl start and, on destruction, pg_ctl stop; everything lives in a temporary directory
+class LocalServer {
+public:
+	LocalServer(const Args& args) : args_(args), dir_(), started_(false) {
+		if (!dir_.isValid()) {
+			fprintf(stderr, "cannot create a temporary directory\n");
+			return;
+		}
+		const QString data = dir_.path() + "/data";
+		if (run("initdb", { "-D", data, "-U", "bench", "-A", "trust", "-E", "UTF8", "--no-sync" }) != 0) {
+			return;
+		}
+		const QString options = QString("-p %1 -c listen_addresses=127.0.0.1 -c unix_socket_directories='' "
+			"-c fsync=off -c synchronous_commit=off -c full_page_writes=off -c max_connections=%2")
+			.arg(args_.port).arg(args_.threads + 20U);
+		started_ = run("pg_ctl", { "-D", data, "-l", dir_.path() + "/server.log", "-o", options, "-w", "start" }) == 0;
+	}
+
+	~LocalServer() {
+		if (started_) {
+			run("pg_ctl", { "-D", dir_.path() + "/data", "-m", "fast", "-w", "stop" });
+		}
+	}
+
+	bool started() const { return started_; }
+
+	QString conninfo() const {
+		return QString("host=127.0.0.1 port=%1 user=bench dbname=postgres").arg(args_.port);
+	}
+
+private:
+	int run(const QString& program, const QStringList& arguments) const {
+		const QString path = args_.bindir.isEmpty() ? program : args_.bindir + "/" + program;
+		const int code = QProcess::execute(path, arguments);
+		if (code != 0) {
+			fprintf(stderr, "%s failed with %d\n", qPrintable(path), code);
+		}
+		return code;
+	}
+
+	const Args& args_;
+	QTemporaryDir dir_;
+	bool started_;
+};
+
+static bool load(PgConnection& conn) {
+	const char* schema[] = {
+		"CREATE TABLE kv (id int8 PRIMARY KEY, name text NOT NULL, value int8 NOT NULL)",
+		"INSERT INTO kv SELECT i, 'name ' || i, i * 7 FROM generate_series(1, 100000) i",
+		"CREATE TABLE log (id bigserial PRIMARY KEY, name text NOT NULL, value int8 NOT NULL)",
+		"CREATE TABLE wide AS SELECT i::int8 AS id, "
+			"i::int4 AS c1, i::int8 AS c2, i::float8 AS c3, 'text ' || i AS c4, (i % 2 = 0) AS c5, "
+			"(i + 1)::int4 AS c6, (i + 1)::int8 AS c7, (i + 1)::float8 AS c8, 'text ' || (i + 1) AS c9, (i % 3 = 0) AS c10, "
+			"(i + 2)::int4 AS c11, (i + 2)::int8 AS c12, (i + 2)::float8 AS c13, 'text ' || (i + 2) AS c14, (i % 5 = 0) AS c15, "
+			"(i + 3)::int4 AS c16, (i + 3)::int8 AS c17, (i + 3)::float8 AS c18, repeat('x', 64) AS c19 "
+			"FROM generate_series(1, 10000) i",
+		"CREATE TABLE blobs (id int8 PRIMARY KEY, data bytea NOT NULL)",
+		"INSERT INTO blobs SELECT i, decode(repeat(md5(i::text), 4096), 'hex') FROM generate_series(1, 1000) i",
+		"VACUUM ANALYZE"
+	};
+	for (const char* statement : schema) {
+		if (!conn.exec(Sql(statement))) {
+			fprintf(stderr, "schema: %s\n", qPrintable(conn.errorMessage()));
+			return false;
+		}
+	}
+	return true;
+}
+
+// runs op on every thread for args.seconds; op returns false on failure
+template<class Op>
+static Result measure(const QString& workload, unsigned threads, int seconds, Op op) {
+	std::vector<std::vector<int64_t>> latencies(threads);
+	std::vector<uint64_t> errors(threads, 0ULL);
+	std::vector<std::thread> workers;
+	const auto start = std::chrono::steady_clock::now();
+	const auto stop = start + std::chrono::seconds(seconds);
+	for (unsigned t = 0U; t < threads; ++t) {
+		workers.emplace_back([&, t] {
+			std::mt19937_64 random(t + 1U);
+			auto& lat = latencies[t];
+			lat.reserve(1 << 20);
+			while (std::chrono::steady_clock::now() < stop) {
+				const auto t0 = std::chrono::steady_clock::now();
+				const bool ok = op(t, random);
+				lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+				errors[t] += ok ? 0ULL : 1ULL;
+			}
+		});
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<int64_t> all;
+	uint64_t failed = 0ULL;
+	for (unsigned t = 0U; t < threads; ++t) {
+		all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+		failed += errors[t];
+	}
+	std::sort(all.begin(), all.end());
+	auto at = [&](double q) { return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<size_t>(q * all.size()))] / 1000.0; };
+
+	Result result{ workload, threads, all.size(), failed, all.size() / elapsed,
+		at(0.5), at(0.95), at(0.99), at(0.999), all.empty() ? 0.0 : all.back() / 1000.0 };
+	printf("%-14s %3u threads %10.0f qps  p50 %8.1f  p99 %8.1f  p999 %8.1f us  errors %llu\n",
+		qPrintable(workload), threads, result.qps, result.p50us, result.p99us, result.p999us,
+		static_cast<unsigned long long>(failed));
+	return result;
+}
+
+static std::vector<Result> runWorkloads(const Args& args, const QString& conninfo) {
+	std::vector<Result> results;
+	PgConnection conn(conninfo);
+
+	results.push_back(measure("point_select", 1U, args.seconds, [&](unsigned, std::mt19937_64& random) {
+		const int64_t id = static_cast<int64_t>(random() % 100000U) + 1;
+		PgResult res = conn.exec(Sql("SELECT name, value FROM kv WHERE id = $1").arg(id));
+		return res.valid() && res.size() == 1U && !res[0].value<QString>(0).isEmpty();
+	}));
+
+	results.push_back(measure("small_insert", 1U, args.seconds, [&](unsigned, std::mt19937_64& random) {
+		return conn.exec(Sql("INSERT INTO log (name, value) VALUES ($1, $2)")
+			.arg("event").arg(static_cast<int64_t>(random() % 1000U))).valid();
+	}));
+
+	results.push_back(measure("wide_fetch", 1U, args.seconds, [&](unsigned, std::mt19937_64& random) {
+		const int64_t from = static_cast<int64_t>(random() % 9900U) + 1;
+		PgResult res = conn.exec(Sql("SELECT * FROM wide WHERE id BETWEEN $1 AND $2").arg(from).arg(from + 99));
+		double sum = 0.0;
+		for (const auto& row : res) {
+			for (uint32_t column = 0U; column < row.size(); ++column) {
+				switch (PQftype(res.get(), static_cast<int>(column))) {
+				case 16: sum += row.value<bool>(column); break;
+				case 20: sum += row.value<int64_t>(column); break;
+				case 23: sum += row.value<int32_t>(column); break;
+				case 701: sum += row.value<double>(column); break;
+				default: sum += row.value<QString>(column).size(); break;
+				}
+			}
+		}
+		return res.size() == 100U && sum > 0.0;
+	}));
+
+	results.push_back(measure("bytea_blob", 1U, args.seconds, [&](unsigned, std::mt19937_64& random) {
+		const int64_t id = static_cast<int64_t>(random() % 1000U) + 1;
+		PgResult res = conn.exec(Sql("SELECT data FROM blobs WHERE id = $1").arg(id));
+		return res.size() == 1U && res[0].value<QByteArray>(0).size() == 65536;
+	}));
+
+	const uint32_t poolSize = std::max(args.threads / 4U, 1U);
+	PgPool pool(PgPool::Options(conninfo, poolSize, poolSize));
+	results.push_back(measure("contention", args.threads, args.seconds, [&](unsigned, std::mt19937_64& random) {
+		auto conn = pool.checkout();
+		if (!conn) {
+			return false;
+		}
+		const int64_t id = static_cast<int64_t>(random() % 100000U) + 1;
+		return conn->exec(Sql("SELECT name, value FROM kv WHERE id = $1").arg(id)).size() == 1U;
+	}));
+
+	return results;
+}
+
+// contents of a JSON string literal
+static QString jsonString(const QString& text) {
+	QString out;
+	out.reserve(text.size());
+	for (const QChar c : text) {
+		if (c == QChar('"') || c == QChar('\\')) {
+			out += QChar('\\');
+			out += c;
+		} else if (c.unicode() < 0x20U) {
+			out += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
+
+// JSON lines or CSV rows, appended so that runs of several versions end up side by side
+static bool write(const Args& args, int serverVersion, const std::vector<Result>& results) {
+	QFile file(args.out);
+	const bool csv = args.out.endsWith(".csv");
+	const bool header = csv && !file.exists();
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+		fprintf(stderr, "cannot write %s\n", qPrintable(args.out));
+		return false;
+	}
+	const QString time = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+	QTextStream out(&file);
+	if (header) {
+		out << "time,label,server,cores,workload,threads,ops,errors,qps,p50_us,p95_us,p99_us,p999_us,max_us\n";
+	}
+	for (const auto& r : results) {
+		if (csv) {
+			out << time << ',' << args.label << ',' << serverVersion << ',' << std::thread::hardware_concurrency() << ','
+				<< r.workload << ',' << r.threads << ',' << r.ops << ',' << r.errors << ',' << r.qps << ','
+				<< r.p50us << ',' << r.p95us << ',' << r.p99us << ',' << r.p999us << ',' << r.maxUs << '\n';
+		} else {
+			out << "{\"time\":\"" << time << "\",\"label\":\"" << jsonString(args.label) << "\",\"server\":" << serverVersion
+				<< ",\"cores\":" << std::thread::hardware_concurrency() << ",\"workload\":\"" << jsonString(r.workload)
+				<< "\",\"threads\":" << r.threads << ",\"ops\":" << r.ops << ",\"errors\":" << r.errors
+				<< ",\"qps\":" << r.qps << ",\"p50_us\":" << r.p50us << ",\"p95_us\":" << r.p95us
+				<< ",\"p99_us\":" << r.p99us << ",\"p999_us\":" << r.p999us << ",\"max_us\":" << r.maxUs << "}\n";
+		}
+	}
+	return true;
+}
+
+// every exec logs its statement through qDebug; keep that out of the measurement
+static void dropDebug(QtMsgType type, const QMessageLogContext&, const QString& message) {
+	if (type != QtDebugMsg) {
+		fprintf(stderr, "%s\n", qPrintable(message));
+	}
+}
+
+int main(int argc, char** argv) {
+	Args args;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const QByteArray name(argv[i]);
+		const char* value = argv[i + 1];
+		if (name == "--bindir") {
+			args.bindir = value;
+		} else if (name == "--seconds") {
+			args.seconds = std::max(atoi(value), 1);
+		} else if (name == "--threads") {
+			args.threads = static_cast<unsigned>(std::max(atoi(value), 1));
+		} else if (name == "--port") {
+			args.port = atoi(value);
+		} else if (name == "--label") {
+			args.label = value;
+		} else if (name == "--out") {
+			args.out = value;
+		} else {
+			fprintf(stderr, "usage: %s [--bindir dir] [--seconds n] [--threads n] [--port n] [--label name] [--out file.json|file.csv]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	qInstallMessageHandler(dropDebug);
+
+	LocalServer server(args);
+	if (!server.started()) {
+		return 1;
+	}
+
+	PgConnection conn(server.conninfo());
+	if (!conn || !load(conn)) {
+		return 1;
+	}
+
+	const auto results = runWorkloads(args, server.conninfo());
+	return write(args, PQserverVersion(conn.get()), results) ? 0 : 1;
+}
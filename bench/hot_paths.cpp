@@ -0,0 +1,155 @@
+// ns/op and heap allocations/op of the client-side hot paths: every SqlParameterList::arg
+// overload, Sql construction, valid(), fingerprint() and operator +=, every value<T> specialization and
+// PgResult/PgRow iteration. Runs on synthetic results, no server needed.
+//
+// g++ -std=c++17 -O2 -I.. hot_paths.cpp $(pkg-config --cflags --libs Qt5Core libpq) -fPIC
+//
+// Keep the output of a release build to compare against the next one.
+
+#define T_PG_ALLOC_TRACKING_IMPLEMENTATION
+#include "synthetic_result.h"
+
+static const int kOps = 1000000;
+static const int kRows = 100000;
+
+static void params() {
+	printf("-- SqlParameterList\n");
+
+	const QByteArray bytes(64, 'x');
+	const QString text = QString(64, QChar('x'));
+	const std::string string(64, 'x');
+	const QVariant variant(text);
+	const QDateTime dateTime(QDate(2024, 1, 2), QTime(3, 4, 5));
+
+	measure("arg(QByteArray&&)", kOps, [&](int64_t) { return SqlParameterList().arg(QByteArray(bytes)).size(); });
+	measure("arg(const QByteArray&)", kOps, [&](int64_t) { return SqlParameterList().arg(bytes).size(); });
+	measure("arg(const char*)", kOps, [&](int64_t) { return SqlParameterList().arg(bytes.constData()).size(); });
+	measure("arg(QString)", kOps, [&](int64_t) { return SqlParameterList().arg(text).size(); });
+	measure("arg(std::string)", kOps, [&](int64_t) { return SqlParameterList().arg(string).size(); });
+	measure("arg(int32_t)", kOps, [&](int64_t i) { return SqlParameterList().arg(static_cast<int32_t>(i)).size(); });
+	measure("arg(int64_t)", kOps, [&](int64_t i) { return SqlParameterList().arg(i).size(); });
+	measure("arg(double)", kOps, [&](int64_t i) { return SqlParameterList().arg(i * 0.5).size(); });
+	measure("arg(QVariant)", kOps, [&](int64_t) { return SqlParameterList().arg(variant).size(); });
+	measure("arg(QDateTime)", kOps, [&](int64_t) { return SqlParameterList().arg(dateTime).size(); });
+	measure("argText(const QByteArray&)", kOps, [&](int64_t) { return SqlParameterList().argText(bytes).size(); });
+	measure("argText(QByteArray&&)", kOps, [&](int64_t) { return SqlParameterList().argText(QByteArray(bytes)).size(); });
+	measure("arg x8 with reserve", kOps, [&](int64_t i) {
+		SqlParameterList list;
+		list.reserve(8);
+		for (int k = 0; k < 8; ++k) {
+			list.arg(i + k);
+		}
+		return list.size();
+	});
+}
+
+static void sql() {
+	printf("-- Sql\n");
+
+	const char* literal = "SELECT id, name, data FROM table WHERE id = $1 AND name = $2";
+	const QByteArray bytes(literal);
+	const QString text(literal);
+	const std::string string(literal);
+
+	measure("Sql(const char*)", kOps, [&](int64_t) { return Sql(literal).command().size(); });
+	measure("Sql(const QByteArray&)", kOps, [&](int64_t) { return Sql(bytes).command().size(); });
+	measure("Sql(QString)", kOps, [&](int64_t) { return Sql(text).command().size(); });
+	measure("Sql(std::string)", kOps, [&](int64_t) { return Sql(string).command().size(); });
+	measure("Sql(...).arg(int64_t).arg(QString)", kOps, [&](int64_t i) {
+		return Sql(literal).arg(i).arg(text).params().size();
+	});
+
+	const Sql bound = Sql(literal).arg(int64_t(1)).arg(text);
+	measure("valid()", kOps, [&](int64_t) { return bound.valid(); });
+	measure("fingerprint() cached", kOps, [&](int64_t) { return bound.fingerprint(); });
+	measure("fingerprint() first call", kOps, [&](int64_t) { return Sql(bytes).fingerprint(); });
+	measure("PG_SQL(...).fingerprint()", kOps, [&](int64_t) {
+		return PG_SQL("SELECT id, name, data FROM table WHERE id = $1 AND name = $2").fingerprint();
+	});
+
+	const Sql where(" AND data IS NOT NULL");
+	measure("operator += (Sql)", kOps, [&](int64_t) { return (Sql(bytes) += where).command().size(); });
+	measure("operator += (QByteArray)", kOps, [&](int64_t) { return (Sql(bytes) += bytes).command().size(); });
+	measure("operator += (const char*)", kOps, [&](int64_t) { return (Sql(bytes) += " LIMIT 1").command().size(); });
+	measure("operator += (char)", kOps, [&](int64_t) { return (Sql(bytes) += ';').command().size(); });
+	measure("build 16 clauses with +=", kOps / 10, [&](int64_t) {
+		Sql query("SELECT * FROM table WHERE true");
+		for (int k = 0; k < 16; ++k) {
+			query += " AND x = 1";
+		}
+		return query.command().size();
+	});
+}
+
+static void values() {
+	printf("-- value<T>\n");
+
+	const QByteArray text(48, 'x');
+	PgResult res = SyntheticResult()
+		.column("i2", 21, 2)
+		.column("i4", 23, 4)
+		.column("i8", 20, 8)
+		.column("f4", 700, 4)
+		.column("f8", 701, 8)
+		.column("b", 16, 1)
+		.column("text", 25, -1)
+		.column("bytea", 17, -1)
+		.column("ts", 1114, 8)
+		.rows(kRows, [&](int row, int column) {
+			switch (column) {
+			case 0: return bigEndian<int16_t>(static_cast<int16_t>(row));
+			case 1: return bigEndian<int32_t>(row);
+			case 2: return bigEndian<int64_t>(row);
+			case 3: return bigEndian<float>(row * 0.5f);
+			case 4: return bigEndian<double>(row * 0.5);
+			case 5: return QByteArray(1, static_cast<char>(row & 1));
+			case 8: return bigEndian<int64_t>(int64_t(row) * 1000000);
+			default: return text;
+			}
+		});
+
+	auto row = [&](int64_t i) { return static_cast<uint32_t>(i % kRows); };
+	measure("value<int16_t>", kOps, [&](int64_t i) { return res.value<int16_t>(row(i), 0); });
+	measure("value<int32_t>", kOps, [&](int64_t i) { return res.value<int32_t>(row(i), 1); });
+	measure("value<int64_t>", kOps, [&](int64_t i) { return res.value<int64_t>(row(i), 2); });
+	measure("value<float>", kOps, [&](int64_t i) { return res.value<float>(row(i), 3); });
+	measure("value<double>", kOps, [&](int64_t i) { return res.value<double>(row(i), 4); });
+	measure("value<bool>", kOps, [&](int64_t i) { return res.value<bool>(row(i), 5); });
+	measure("value<QString>", kOps, [&](int64_t i) { return res.value<QString>(row(i), 6).size(); });
+	measure("value<QByteArray>", kOps, [&](int64_t i) { return res.value<QByteArray>(row(i), 7).size(); });
+	measure("value<QDateTime>", kOps / 10, [&](int64_t i) { return res.value<QDateTime>(row(i), 8).isValid(); });
+
+	// one op is a pass over all kRows rows
+	printf("-- iteration\n");
+
+	measure("for (row : res) per result", 10, [&](int64_t) {
+		int64_t sum = 0;
+		for (const auto& r : res) {
+			sum += r.value<int64_t>(2);
+		}
+		return sum;
+	});
+	measure("res[i] per result", 10, [&](int64_t) {
+		int64_t sum = 0;
+		for (uint32_t i = 0; i < res.size(); ++i) {
+			sum += res[i].value<int64_t>(2);
+		}
+		return sum;
+	});
+	measure("for (row) for (column : row) per result", 10, [&](int64_t) {
+		size_t cells = 0;
+		for (const auto& r : res) {
+			for (const auto& column : r) {
+				cells += column.isNull() ? 0U : 1U;
+			}
+		}
+		return cells;
+	});
+}
+
+int main() {
+	params();
+	sql();
+	values();
+	return 0;
+}
@@ -0,0 +1,105 @@
+// Checkout contention of PgPool at 1..64 threads, against one PgConnection behind a mutex.
+//
+// g++ -std=c++17 -O2 -I.. pool_contention.cpp $(pkg-config --cflags --libs Qt5Core libpq) -pthread -fPIC
+// ./a.out "host=localhost dbname=postgres" [iterations per thread]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "../t_pg_pool.h"
+
+struct Sample {
+	double opsPerSec;
+	double p50us;
+	double p99us;
+	uint64_t errors;
+};
+
+// fn returns false for a failed iteration: a checkout timeout or a failed exec
+template<class Fn>
+static Sample run(unsigned threads, int iterations, Fn fn) {
+	std::vector<std::vector<int64_t>> latencies(threads);
+	std::vector<std::thread> workers;
+	std::atomic<uint64_t> errors{ 0ULL };
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned t = 0U; t < threads; ++t) {
+		workers.emplace_back([&, t] {
+			auto& lat = latencies[t];
+			lat.reserve(iterations);
+			for (int i = 0; i < iterations; ++i) {
+				const auto t0 = std::chrono::steady_clock::now();
+				if (!fn()) {
+					errors.fetch_add(1ULL, std::memory_order_relaxed);
+				}
+				lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+			}
+		});
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<int64_t> all;
+	for (auto& lat : latencies) {
+		all.insert(all.end(), lat.begin(), lat.end());
+	}
+	std::sort(all.begin(), all.end());
+	return {
+		all.size() / seconds,
+		all[all.size() / 2] / 1000.0,
+		all[all.size() * 99 / 100] / 1000.0,
+		errors.load()
+	};
+}
+
+static void print(const char* name, unsigned threads, const Sample& s) {
+	printf("%-18s %3u threads %12.0f ops/s  p50 %9.2f us  p99 %9.2f us  errors %llu\n", name, threads, s.opsPerSec, s.p50us, s.p99us,
+		static_cast<unsigned long long>(s.errors));
+}
+
+// every exec logs its statement through qDebug, behind the global lock of Qt's message
+// handler; keep that out of the measurement
+static void dropDebug(QtMsgType type, const QMessageLogContext&, const QString& message) {
+	if (type != QtDebugMsg) {
+		fprintf(stderr, "%s\n", qPrintable(message));
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s conninfo [iterations]\n", argv[0]);
+		return 1;
+	}
+	const QString conninfo(argv[1]);
+	const int iterations = (argc > 2) ? atoi(argv[2]) : 2000;
+
+	qInstallMessageHandler(dropDebug);
+
+	for (unsigned threads = 1U; threads <= 64U; threads *= 2U) {
+		PgPool pool(PgPool::Options(conninfo, threads, threads));
+
+		print("checkout", threads, run(threads, iterations * 10, [&] {
+			auto conn = pool.checkout();
+			return static_cast<bool>(conn);
+		}));
+
+		print("checkout+SELECT 1", threads, run(threads, iterations, [&] {
+			auto conn = pool.checkout();
+			if (!conn) {
+				return false;
+			}
+			return conn->exec(Sql("SELECT 1")).valid();
+		}));
+
+		PgConnection shared(conninfo);
+		std::mutex mutex;
+		print("mutex+SELECT 1", threads, run(threads, iterations, [&] {
+			std::lock_guard<std::mutex> lock(mutex);
+			return shared.exec(Sql("SELECT 1")).valid();
+		}));
+	}
+	return 0;
+}
@@ -0,0 +1,218 @@
+// Checks PgReplicaRouter against a throwaway primary and hot standby: initdb and pg_ctl for
+// the primary, pg_basebackup -R for the standby, both in a temporary directory. Every
+// statement asks the server it ran on for pg_is_in_recovery(), so the output shows where
+// reads and writes were routed, what happens when the standby goes away and comes back, and
+// that reads keep going to the standby once the primary is down.
+// Exits with 1 if a check fails.
+//
+// g++ -std=c++17 -O2 -I.. replica_routing.cpp $(pkg-config --cflags --libs Qt5Core libpq) -pthread -fPIC
+// ./a.out --bindir /usr/lib/postgresql/16/bin
+
+#include <cstdio>
+#include <thread>
+
+#include "../t_pg_router.h"
+
+struct Args {
+	QString bindir;
+	int port = 54339;
+};
+
+// a primary, a standby streaming from it and, on destruction, pg_ctl stop for both
+class LocalCluster {
+public:
+	LocalCluster(const Args& args) : args_(args), dir_(), primary_(false), standby_(false) {
+		if (!dir_.isValid()) {
+			fprintf(stderr, "cannot create a temporary directory\n");
+			return;
+		}
+		if (run("initdb", { "-D", data(0), "-U", "bench", "-A", "trust", "-E", "UTF8", "--no-sync" }) != 0) {
+			return;
+		}
+		primary_ = start(0);
+		if (!primary_ || run("pg_basebackup", { "-h", "127.0.0.1", "-p", QString::number(args_.port), "-U", "bench",
+			"-D", data(1), "-R", "-X", "stream", "--no-sync" }) != 0) {
+			return;
+		}
+		standby_ = start(1);
+	}
+
+	~LocalCluster() {
+		if (standby_) {
+			stopStandby();
+		}
+		if (primary_) {
+			run("pg_ctl", { "-D", data(0), "-m", "fast", "-w", "stop" });
+		}
+	}
+
+	bool started() const { return primary_ && standby_; }
+
+	QString conninfo(int node) const {
+		return QString("host=127.0.0.1 port=%1 user=bench dbname=postgres").arg(args_.port + node);
+	}
+
+	// as if the primary crashed
+	bool stopPrimary() {
+		primary_ = !(run("pg_ctl", { "-D", data(0), "-m", "immediate", "-w", "stop" }) == 0);
+		return !primary_;
+	}
+
+	// as if the standby crashed
+	bool stopStandby() {
+		standby_ = !(run("pg_ctl", { "-D", data(1), "-m", "immediate", "-w", "stop" }) == 0);
+		return !standby_;
+	}
+
+	bool startStandby() {
+		standby_ = start(1);
+		return standby_;
+	}
+
+private:
+	QString data(int node) const { return dir_.path() + ((node == 0) ? "/primary" : "/standby"); }
+
+	bool start(int node) const {
+		const QString options = QString("-p %1 -c listen_addresses=127.0.0.1 -c unix_socket_directories='' "
+			"-c fsync=off -c hot_standby=on").arg(args_.port + node);
+		return run("pg_ctl", { "-D", data(node), "-l", data(node) + ".log", "-o", options, "-w", "start" }) == 0;
+	}
+
+	int run(const QString& program, const QStringList& arguments) const {
+		const QString path = args_.bindir.isEmpty() ? program : args_.bindir + "/" + program;
+		const int code = QProcess::execute(path, arguments);
+		if (code != 0) {
+			fprintf(stderr, "%s failed with %d\n", qPrintable(path), code);
+		}
+		return code;
+	}
+
+	const Args& args_;
+	QTemporaryDir dir_;
+	bool primary_;
+	bool standby_;
+};
+
+enum class Server { Primary, Standby, Failed };
+
+static const char* name(Server server) {
+	switch (server) {
+	case Server::Primary: return "primary";
+	case Server::Standby: return "standby";
+	case Server::Failed: return "failed";
+	}
+	return "";
+}
+
+// where res came from, for statements whose first column is pg_is_in_recovery()
+static Server where(const PgResult& res) {
+	if (!res.valid() || res.size() != 1U) {
+		return Server::Failed;
+	}
+	return res[0].value<bool>(0) ? Server::Standby : Server::Primary;
+}
+
+static int failures = 0;
+
+static void check(const char* what, Server got, Server expected) {
+	const bool ok = got == expected;
+	printf("%-4s %-44s %-8s (expected %s)\n", ok ? "ok" : "FAIL", what, name(got), name(expected));
+	failures += ok ? 0 : 1;
+}
+
+static void check(const char* what, bool ok) {
+	printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+	failures += ok ? 0 : 1;
+}
+
+// retries fn until it returns true, for up to timeout
+template<class Fn>
+static bool eventually(Fn fn, std::chrono::milliseconds timeout = std::chrono::seconds(15)) {
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (!fn()) {
+		if (std::chrono::steady_clock::now() >= deadline) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	return true;
+}
+
+// every exec logs its statement through qDebug; keep the report readable
+static void dropDebug(QtMsgType type, const QMessageLogContext&, const QString& message) {
+	if (type != QtDebugMsg) {
+		fprintf(stderr, "%s\n", qPrintable(message));
+	}
+}
+
+int main(int argc, char** argv) {
+	Args args;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const QByteArray option(argv[i]);
+		if (option == "--bindir") {
+			args.bindir = argv[i + 1];
+		} else if (option == "--port") {
+			args.port = atoi(argv[i + 1]);
+		} else {
+			fprintf(stderr, "usage: %s [--bindir dir] [--port n]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	qInstallMessageHandler(dropDebug);
+
+	LocalCluster cluster(args);
+	if (!cluster.started()) {
+		return 1;
+	}
+
+	const Sql read("SELECT pg_is_in_recovery()");
+	PgReplicaRouter::Options options;
+	options.demoteFor = std::chrono::seconds(1);
+	options.lagInterval = std::chrono::milliseconds(200);
+	PgReplicaRouter router(cluster.conninfo(0), { cluster.conninfo(1) }, options);
+
+	// fails on a standby
+	check("CREATE TABLE", router.exec(Sql("CREATE TABLE routed (standby bool)")).valid());
+	check("INSERT ... RETURNING", where(router.exec(Sql(
+		"INSERT INTO routed VALUES (false) RETURNING pg_is_in_recovery()"))), Server::Primary);
+	check("read", where(router.exec(read)), Server::Standby);
+	check("SELECT ... FOR UPDATE", where(router.exec(Sql(
+		"SELECT pg_is_in_recovery() FROM routed LIMIT 1 FOR UPDATE"))), Server::Primary);
+	check("CREATE SEQUENCE", router.exec(Sql("CREATE SEQUENCE routed_id")).valid());
+	check("SELECT nextval", where(router.exec(Sql(
+		"SELECT pg_is_in_recovery(), nextval('routed_id')"))), Server::Primary);
+
+	router.execWrite(Sql("BEGIN"));
+	check("read inside a transaction", where(router.exec(read)), Server::Primary);
+	router.execWrite(Sql("COMMIT"));
+	check("read after the transaction", where(router.exec(read)), Server::Standby);
+
+	{
+		PgReplicaRouter::Options sticky(options);
+		sticky.stickyAfterWrite = std::chrono::seconds(2);
+		PgReplicaRouter stickyRouter(cluster.conninfo(0), { cluster.conninfo(1) }, sticky);
+		stickyRouter.exec(Sql("INSERT INTO routed VALUES (false)"));
+		check("read within stickyAfterWrite", where(stickyRouter.exec(read)), Server::Primary);
+	}
+
+	check("standby stopped", cluster.stopStandby());
+	check("read with the standby down fails over", where(router.exec(read)), Server::Primary);
+	check("standby demoted", !router.stats().empty() && router.stats()[0].demoted);
+	check("write with the standby down", where(router.exec(Sql(
+		"INSERT INTO routed VALUES (false) RETURNING pg_is_in_recovery()"))), Server::Primary);
+
+	check("standby restarted", cluster.startStandby());
+	// a commit to replay, so the standby reports its lag again
+	router.exec(Sql("INSERT INTO routed VALUES (false)"));
+	check("reads return to the standby after demoteFor", eventually([&] {
+		return where(router.exec(read)) == Server::Standby;
+	}));
+
+	check("primary stopped", cluster.stopPrimary());
+	check("write with the primary down fails", !router.exec(Sql("INSERT INTO routed VALUES (false)")).valid());
+	check("read with the primary down", where(router.exec(read)), Server::Standby);
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
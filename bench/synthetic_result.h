@@ -0,0 +1,75 @@
+#ifndef T_PG_BENCH_SYNTHETIC_RESULT_H
+#define T_PG_BENCH_SYNTHETIC_RESULT_H
+
+#include <chrono>
+#include <cstdio>
+
+#include "../t_pg.h"
+
+// A benchmark that defines T_PG_ALLOC_TRACKING_IMPLEMENTATION before this include gets
+// heap allocations per op from measure() as well, see pgAllocTracking().
+inline uint64_t benchAllocations() { return pgThreadAllocations().allocations; }
+
+// Builds PGresults in memory with PQmakeEmptyPGresult/PQsetResultAttrs/PQsetvalue,
+// in the binary format exec() asks for, so benchmarks run without a server.
+class SyntheticResult {
+public:
+	SyntheticResult() : res_(makePgHandle(PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK))), columns_() {}
+
+	SyntheticResult& column(const char* name, Oid type, int size) {
+		PGresAttDesc desc{};
+		desc.name = const_cast<char*>(name);
+		desc.format = 1;
+		desc.typid = type;
+		desc.typlen = size;
+		desc.atttypmod = -1;
+		columns_.push_back(desc);
+		return *this;
+	}
+
+	// fill(row, column) returns the binary value of a cell, a null QByteArray for NULL
+	template<class Fn>
+	PgResult rows(int n_rows, Fn fill) {
+		PQsetResultAttrs(res_.get(), static_cast<int>(columns_.size()), columns_.data());
+		for (int row = 0; row < n_rows; ++row) {
+			for (int column = 0; column < static_cast<int>(columns_.size()); ++column) {
+				QByteArray cell = fill(row, column);
+				PQsetvalue(res_.get(), row, column,
+					cell.isNull() ? nullptr : cell.data(),
+					cell.isNull() ? -1 : static_cast<int>(cell.size()));
+			}
+		}
+		return PgResult(std::move(res_));
+	}
+
+private:
+	PgHandle<PGresult> res_;
+	std::vector<PGresAttDesc> columns_;
+};
+
+template<class T> inline
+QByteArray bigEndian(T value) {
+	QByteArray data(sizeof(T), '\0');
+	qToBigEndian(value, reinterpret_cast<uchar*>(data.data()));
+	return data;
+}
+
+// runs fn n times and prints ns per op; the result of fn is kept alive to defeat the optimizer
+template<class Fn> inline
+double measure(const char* name, int64_t n, Fn fn) {
+	volatile size_t sink = 0;
+	const uint64_t allocations = benchAllocations();
+	const auto start = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < n; ++i) {
+		sink = sink + static_cast<size_t>(fn(i));
+	}
+	const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+	if (pgAllocTracking()) {
+		printf("%-40s %10.2f ns/op %8.2f allocs/op\n", name, ns, static_cast<double>(benchAllocations() - allocations) / n);
+	} else {
+		printf("%-40s %10.2f ns/op\n", name, ns);
+	}
+	return ns;
+}
+
+#endif
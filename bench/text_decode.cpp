@@ -0,0 +1,62 @@
+// value<QString> and arg(QString) throughput in each PgTextEncoding, on a synthetic result
+// of ASCII and Cyrillic text columns.
+//
+// g++ -std=c++17 -O2 -I.. text_decode.cpp $(pkg-config --cflags --libs Qt5Core libpq) -fPIC
+//
+// The fromLocal8Bit baseline decodes through the process locale, so run it under a cp1251
+// locale for its Cyrillic numbers to mean anything.
+
+#include "synthetic_result.h"
+
+static const int kRows = 100000;
+
+static void run(PgTextEncoding encoding, const char* label, const QByteArray& ascii, const QByteArray& cyrillic) {
+	setPgTextEncoding(encoding);
+	printf("-- %s\n", label);
+
+	PgResult res = SyntheticResult()
+		.column("ascii", 25, -1)
+		.column("cyrillic", 25, -1)
+		.rows(kRows, [&](int, int column) { return column ? cyrillic : ascii; });
+
+	measure("value<QString> ascii", kRows, [&](int64_t i) {
+		return res[static_cast<uint32_t>(i)].value<QString>(0).size();
+	});
+	measure("value<QString> cyrillic", kRows, [&](int64_t i) {
+		return res[static_cast<uint32_t>(i)].value<QString>(1).size();
+	});
+	measure("value<QByteArray> raw", kRows, [&](int64_t i) {
+		return res[static_cast<uint32_t>(i)].value<QByteArray>(1).size();
+	});
+	if (encoding == PgTextEncoding::Win1251) {
+		measure("fromLocal8Bit cyrillic (baseline)", kRows, [&](int64_t) {
+			return QString::fromLocal8Bit(cyrillic.constData(), static_cast<int>(cyrillic.size())).size();
+		});
+	}
+
+	const QString text = decodeText(cyrillic.constData(), static_cast<int>(cyrillic.size()));
+	measure("arg(QString) cyrillic", kRows, [&](int64_t) {
+		return SqlParameterList().arg(text).size();
+	});
+	measure("argText(QByteArray) raw", kRows, [&](int64_t) {
+		return SqlParameterList().argText(cyrillic).size();
+	});
+}
+
+int main() {
+	const QByteArray ascii("The quick brown fox jumps over the lazy dog, 0123456789 times over.");
+	// "Съешь же ещё этих мягких французских булок, да выпей чаю" in WIN1251 and UTF-8
+	const QByteArray win1251(
+		"\xD1\xFA\xE5\xF8\xFC \xE6\xE5 \xE5\xF9\xB8 \xFD\xF2\xE8\xF5 \xEC\xFF\xE3\xEA\xE8\xF5 "
+		"\xF4\xF0\xE0\xED\xF6\xF3\xE7\xF1\xEA\xE8\xF5 \xE1\xF3\xEB\xEE\xEA, \xE4\xE0 \xE2\xFB\xEF\xE5\xE9 \xF7\xE0\xFE");
+	const QByteArray utf8 = QString::fromUtf8(
+		"\xD0\xA1\xD1\x8A\xD0\xB5\xD1\x88\xD1\x8C \xD0\xB6\xD0\xB5 \xD0\xB5\xD1\x89\xD1\x91 "
+		"\xD1\x8D\xD1\x82\xD0\xB8\xD1\x85 \xD0\xBC\xD1\x8F\xD0\xB3\xD0\xBA\xD0\xB8\xD1\x85 "
+		"\xD1\x84\xD1\x80\xD0\xB0\xD0\xBD\xD1\x86\xD1\x83\xD0\xB7\xD1\x81\xD0\xBA\xD0\xB8\xD1\x85 "
+		"\xD0\xB1\xD1\x83\xD0\xBB\xD0\xBE\xD0\xBA, \xD0\xB4\xD0\xB0 \xD0\xB2\xD1\x8B\xD0\xBF\xD0\xB5\xD0\xB9 "
+		"\xD1\x87\xD0\xB0\xD1\x8E").toUtf8();
+
+	run(PgTextEncoding::Win1251, "Win1251", ascii, win1251);
+	run(PgTextEncoding::Utf8, "Utf8", ascii, utf8);
+	return 0;
+}
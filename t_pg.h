@@ -1,15 +1,40 @@
 #ifndef T_PG_H
 #define T_PG_H
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <thread>
 #include <vector>
 #include <memory>
+#include <mutex>
 
 #include <QtCore>
 #include <QtEndian>
 
 #include <libpq-fe.h>
 
+#include "t_pg_win1251.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 inline void close(PGconn* conn) { PQfinish(conn); }
 
 inline void close(PGresult* res) { PQclear(res); }
@@ -43,6 +68,35 @@ using PgHandle = Closer<T> ;
 template<class T> inline
 PgHandle<T> makePgHandle(T* p) { return p; }
 
+// Text encoding of the client side of every connection in the process.
+// Win1251, the default, sets client_encoding WIN1251 and converts with the table codec of t_pg_win1251.h;
+// Utf8 sets client_encoding UTF8 and uses the SIMD fromUtf8/toUtf8 conversions.
+// Set it before opening connections.
+enum class PgTextEncoding { Win1251, Utf8 };
+
+inline std::atomic<PgTextEncoding>& pgTextEncodingStorage() {
+	static std::atomic<PgTextEncoding> encoding{ PgTextEncoding::Win1251 };
+	return encoding;
+}
+
+inline PgTextEncoding pgTextEncoding() { return pgTextEncodingStorage().load(std::memory_order_relaxed); }
+
+inline void setPgTextEncoding(PgTextEncoding encoding) { pgTextEncodingStorage().store(encoding); }
+
+inline const char* pgClientEncoding() {
+	return (pgTextEncoding() == PgTextEncoding::Utf8) ? "UTF8" : "WIN1251";
+}
+
+inline QString decodeText(const char* data, int size) {
+	return (pgTextEncoding() == PgTextEncoding::Utf8) ?
+		QString::fromUtf8(data, size) :
+		pg_win1251::toQString(data, size);
+}
+
+inline QByteArray encodeText(const QString& text) {
+	return (pgTextEncoding() == PgTextEncoding::Utf8) ? text.toUtf8() : pg_win1251::fromQString(text);
+}
+
 class SqlParameterList {
 public:
 	SqlParameterList() : params_(), formats_() {}
@@ -106,7 +160,24 @@ public:
 
 	SqlParameterList& arg(const QString& data) {
 		if (validateData(data)) {
-			params_.emplace_back(data.toLocal8Bit());
+			params_.emplace_back(encodeText(data));
+			formats_.push_back(0);
+		}
+		return *this;
+	}
+
+	// text already in the client encoding, sent without conversion
+	SqlParameterList& argText(const QByteArray& data) {
+		if (validateData(data)) {
+			params_.push_back(data);
+			formats_.push_back(0);
+		}
+		return *this;
+	}
+
+	SqlParameterList& argText(QByteArray&& data) {
+		if (validateData(data)) {
+			params_.emplace_back(std::move(data));
 			formats_.push_back(0);
 		}
 		return *this;
@@ -197,55 +268,335 @@ inline SqlParameterList operator + (const SqlParameterList& a, const SqlParamete
 }
 
 
+// Byte classes for PgSqlLexer, so the loops over words and spaces take one lookup per byte
+struct PgSqlCharClasses {
+	// Special: may start a string, quoted identifier, comment, placeholder or dollar quote
+	enum : unsigned char { Space = 1, Digit = 2, IdentStart = 4, Ident = 8, Special = 16 };
+
+	constexpr PgSqlCharClasses() : of() {
+		for (int c = 0; c < 256; ++c) {
+			const bool space = c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+			const bool digit = c >= '0' && c <= '9';
+			const bool start = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80;
+			const bool special = c == '\'' || c == '"' || c == '$' || c == '-' || c == '/';
+			of[c] = static_cast<unsigned char>((space ? Space : 0) | (digit ? Digit : 0) |
+				(start ? IdentStart : 0) | ((start || digit || c == '$') ? Ident : 0) | (special ? Special : 0));
+		}
+	}
+
+	unsigned char of[256];
+};
+
+// The PostgreSQL lexical rules Sql needs, in one pass and constexpr so literals can be scanned
+// at compile time. Each skip takes the index of the opening character and returns the index
+// past the closing one, or the size when the text ends first.
+struct PgSqlLexer {
+	enum Kind {
+		Space,
+		// -- or /* */
+		Comment,
+		// 'string', E'string', B'0101', X'ff', $tag$string$tag$ or a number
+		Literal,
+		// $1
+		Param,
+		// keyword or identifier, possibly with $ inside
+		Word,
+		// "identifier"
+		QuotedWord,
+		// anything else, one character
+		Symbol
+	};
+
+	struct Token {
+		Kind kind;
+		size_t end;
+	};
+
+	static constexpr PgSqlCharClasses kClasses{};
+
+	static constexpr bool is(char c, unsigned char mask) {
+		return (kClasses.of[static_cast<unsigned char>(c)] & mask) != 0;
+	}
+
+	static constexpr bool isSpace(char c) { return is(c, PgSqlCharClasses::Space); }
+
+	static constexpr bool isDigit(char c) { return is(c, PgSqlCharClasses::Digit); }
+
+	static constexpr bool isIdentStart(char c) { return is(c, PgSqlCharClasses::IdentStart); }
+
+	static constexpr bool isIdent(char c) { return is(c, PgSqlCharClasses::Ident); }
+
+	static constexpr bool isSpecial(char c) { return is(c, PgSqlCharClasses::Special); }
+
+	static constexpr char lower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c; }
+
+	// 'text' with '' inside, and with backslash escapes for E'text'
+	static constexpr size_t skipString(const char* s, size_t n, size_t i, bool escapes) {
+		for (++i; i < n; ++i) {
+			if (escapes && s[i] == '\\') {
+				++i;
+			} else if (s[i] == '\'') {
+				if (i + 1 < n && s[i + 1] == '\'') {
+					++i;
+				} else {
+					return i + 1;
+				}
+			}
+		}
+		return n;
+	}
+
+	// "identifier" with "" inside
+	static constexpr size_t skipQuotedIdent(const char* s, size_t n, size_t i) {
+		for (++i; i < n; ++i) {
+			if (s[i] == '"') {
+				if (i + 1 < n && s[i + 1] == '"') {
+					++i;
+				} else {
+					return i + 1;
+				}
+			}
+		}
+		return n;
+	}
+
+	// -- to the end of the line, or /* */ which nests
+	static constexpr size_t skipComment(const char* s, size_t n, size_t i) {
+		if (s[i] == '-') {
+			while (i < n && s[i] != '\n') {
+				++i;
+			}
+			return i;
+		}
+		int depth = 0;
+		while (i < n) {
+			if (s[i] == '/' && i + 1 < n && s[i + 1] == '*') {
+				++depth;
+				i += 2;
+			} else if (s[i] == '*' && i + 1 < n && s[i + 1] == '/') {
+				i += 2;
+				if (--depth == 0) {
+					return i;
+				}
+			} else {
+				++i;
+			}
+		}
+		return n;
+	}
+
+	static constexpr bool isComment(const char* s, size_t n, size_t i) {
+		return i + 1 < n && ((s[i] == '-' && s[i + 1] == '-') || (s[i] == '/' && s[i + 1] == '*'));
+	}
+
+	// index past the $tag$ opening a dollar-quoted string at i, 0 when there is none
+	static constexpr size_t dollarTag(const char* s, size_t n, size_t i) {
+		size_t j = i + 1;
+		if (j < n && isDigit(s[j])) {
+			return 0;
+		}
+		while (j < n && isIdent(s[j]) && s[j] != '$') {
+			++j;
+		}
+		return (j < n && s[j] == '$') ? j + 1 : 0;
+	}
+
+	// $tag$ ... $tag$, with tagEnd from dollarTag
+	static constexpr size_t skipDollarQuote(const char* s, size_t n, size_t i, size_t tagEnd) {
+		const size_t tag = tagEnd - i;
+		for (size_t j = tagEnd; j + tag <= n; ++j) {
+			size_t k = 0;
+			while (k < tag && s[j + k] == s[i + k]) {
+				++k;
+			}
+			if (k == tag) {
+				return j + tag;
+			}
+		}
+		return n;
+	}
+
+	// the token starting at i, i < n
+	static constexpr Token next(const char* s, size_t n, size_t i) {
+		const char c = s[i];
+		const char following = (i + 1 < n) ? s[i + 1] : '\0';
+		if (isSpace(c)) {
+			size_t end = i + 1;
+			while (end < n && isSpace(s[end])) {
+				++end;
+			}
+			return Token{ Space, end };
+		}
+		if (isComment(s, n, i)) {
+			return Token{ Comment, skipComment(s, n, i) };
+		}
+		if (c == '\'') {
+			return Token{ Literal, skipString(s, n, i, false) };
+		}
+		if ((c == 'E' || c == 'e' || c == 'B' || c == 'b' || c == 'X' || c == 'x') && following == '\'') {
+			return Token{ Literal, skipString(s, n, i + 1, c == 'E' || c == 'e') };
+		}
+		if (isDigit(c) || (c == '.' && isDigit(following))) {
+			return Token{ Literal, skipNumber(s, n, i) };
+		}
+		if (c == '$') {
+			if (isDigit(following)) {
+				size_t end = i + 1;
+				while (end < n && isDigit(s[end])) {
+					++end;
+				}
+				return Token{ Param, end };
+			}
+			const size_t tagEnd = dollarTag(s, n, i);
+			return tagEnd ? Token{ Literal, skipDollarQuote(s, n, i, tagEnd) } : Token{ Symbol, i + 1 };
+		}
+		if (isIdentStart(c)) {
+			size_t end = i + 1;
+			while (end < n && isIdent(s[end])) {
+				++end;
+			}
+			return Token{ Word, end };
+		}
+		if (c == '"') {
+			return Token{ QuotedWord, skipQuotedIdent(s, n, i) };
+		}
+		return Token{ Symbol, i + 1 };
+	}
+
+	// numeric constant: 42, 3.5, .5, 1e-3
+	static constexpr size_t skipNumber(const char* s, size_t n, size_t i) {
+		while (i < n && (isDigit(s[i]) || s[i] == '.' || s[i] == '_')) {
+			++i;
+		}
+		if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+			size_t j = i + 1;
+			if (j < n && (s[j] == '+' || s[j] == '-')) {
+				++j;
+			}
+			if (j < n && isDigit(s[j])) {
+				i = j;
+				while (i < n && isDigit(s[i])) {
+					++i;
+				}
+			}
+		}
+		return i;
+	}
+};
+
+// Normalized 64-bit FNV-1a of a statement: whitespace and comments are ignored, unquoted
+// words are lowercased and every string, number and dollar-quoted constant hashes as '?',
+// so "SELECT * FROM t WHERE id = 1" and "select *  from t where id=2 -- again" match.
+// $n placeholders and quoted identifiers are kept. Never 0.
+constexpr uint64_t pgFingerprint(const char* s, size_t n) {
+	uint64_t h = 14695981039346656037ULL;
+	auto mix = [](uint64_t hash, char c) { return (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL; };
+	// a separator is hashed only between two words, where dropping it would merge them
+	bool gap = false;
+	bool lastWord = false;
+	for (size_t i = 0; i < n; ) {
+		const auto token = PgSqlLexer::next(s, n, i);
+		const bool word = token.kind != PgSqlLexer::Symbol;
+		if (token.kind == PgSqlLexer::Space || token.kind == PgSqlLexer::Comment) {
+			gap = true;
+			i = token.end;
+			continue;
+		}
+		if (gap && word && lastWord) {
+			h = mix(h, ' ');
+		}
+		if (token.kind == PgSqlLexer::Literal) {
+			h = mix(h, '?');
+		} else if (token.kind == PgSqlLexer::QuotedWord) {
+			for (size_t k = i; k < token.end; ++k) {
+				h = mix(h, s[k]);
+			}
+		} else {
+			for (size_t k = i; k < token.end; ++k) {
+				h = mix(h, PgSqlLexer::lower(s[k]));
+			}
+		}
+		gap = false;
+		lastWord = word;
+		i = token.end;
+	}
+	return h ? h : 1ULL;
+}
+
+// Sql with the fingerprint of a string literal computed at compile time
+// auto sql = PG_SQL("SELECT data FROM table WHERE id = $1").arg(id);
+#define PG_SQL(literal) Sql(literal, std::integral_constant<uint64_t, pgFingerprint(literal, sizeof(literal) - 1)>::value)
+
 // Sql("INSERT INTO table (name, data) VALUES ($1, $2::bytea)").arg(name).arg(data)
 class Sql {
 public:
-	Sql() : command_(), params_() {}
-	Sql(const char* cmd) : command_(cmd), params_() {}
-	Sql(const std::string& cmd) : command_(QByteArray::fromRawData(cmd.data(), cmd.size())), params_() {}
-	Sql(const QByteArray& cmd) : command_(cmd), params_() {}
-	Sql(QByteArray&& cmd) : command_(std::move(cmd)), params_() {}
-	Sql(const QString& cmd) : command_(cmd.toLocal8Bit()), params_() {}
-	Sql(const Sql& sql_) : command_(sql_.command_), params_(sql_.params_) {}
+	Sql() : command_(), params_(), placeholders_(), fingerprint_(0ULL) {}
+	Sql(const char* cmd) : command_(cmd), params_(), placeholders_(), fingerprint_(0ULL) { lex(); }
+	// cmd with its pgFingerprint already known, see PG_SQL
+	Sql(const char* cmd, uint64_t fingerprint) : command_(cmd), params_(), placeholders_(), fingerprint_(fingerprint) { lex(); }
+	Sql(const std::string& cmd) :
+		command_(QByteArray::fromRawData(cmd.data(), cmd.size())),
+		params_(),
+		placeholders_(),
+		fingerprint_(0ULL) { lex(); }
+	Sql(const QByteArray& cmd) : command_(cmd), params_(), placeholders_(), fingerprint_(0ULL) { lex(); }
+	Sql(QByteArray&& cmd) : command_(std::move(cmd)), params_(), placeholders_(), fingerprint_(0ULL) { lex(); }
+	Sql(const QString& cmd) : command_(encodeText(cmd)), params_(), placeholders_(), fingerprint_(0ULL) { lex(); }
+	Sql(const Sql& sql_) :
+		command_(sql_.command_),
+		params_(sql_.params_),
+		placeholders_(sql_.placeholders_),
+		fingerprint_(sql_.fingerprint_.load(std::memory_order_relaxed)) {}
 	Sql(Sql&& sql_) :
 		command_(std::move(sql_.command_)),
-		params_(std::move(sql_.params_)) {}
+		params_(std::move(sql_.params_)),
+		placeholders_(sql_.placeholders_),
+		fingerprint_(sql_.fingerprint_.load(std::memory_order_relaxed)) {}
 
 	Sql& operator = (const Sql& sql_) {
 		command_ = sql_.command_;
 		params_ = sql_.params_;
+		placeholders_ = sql_.placeholders_;
+		fingerprint_.store(sql_.fingerprint_.load(std::memory_order_relaxed), std::memory_order_relaxed);
 		return *this;
 	}
 
 	Sql& operator = (Sql&& sql_) {
 		command_ = std::move(sql_.command_);
 		params_ = std::move(sql_.params_);
+		placeholders_ = sql_.placeholders_;
+		fingerprint_.store(sql_.fingerprint_.load(std::memory_order_relaxed), std::memory_order_relaxed);
 		return *this;
 	}
 
 	Sql& operator += (const Sql& sql_) {
 		command_ += sql_.command_;
 		params_ += sql_.params_;
+		appended();
 		return *this;
 	}
 
 	Sql& operator += (const QByteArray& sql_) {
 		command_ += sql_;
+		appended();
 		return *this;
 	}
 
 	Sql& operator += (QByteArray&& sql_) {
 		command_ += std::move(sql_);
+		appended();
 		return *this;
 	}
 
 	Sql& operator += (const char* sql_) {
 		command_ += sql_;
+		appended();
 		return *this;
 	}
 
 	Sql& operator += (char c) {
 		command_ += c;
+		appended();
 		return *this;
 	}
 
@@ -261,16 +612,35 @@ public:
 		return *this;
 	}
 
+	template<class T>
+	Sql& argText(T&& data) {
+		params_.argText(std::forward<T>(data));
+		return *this;
+	}
+
 	const QByteArray& command() const { return command_; }
 
 	const char* c_command() const { return command(); }
 
 	const SqlParameterList& params() const { return params_; }
 
+	// pgFingerprint of the command, computed on first use and kept until the command changes;
+	// the identity statement caches and statistics are keyed on
+	uint64_t fingerprint() const {
+		uint64_t fingerprint = fingerprint_.load(std::memory_order_relaxed);
+		if (!fingerprint) {
+			fingerprint = pgFingerprint(command_.constData(), static_cast<size_t>(command_.size()));
+			fingerprint_.store(fingerprint, std::memory_order_relaxed);
+		}
+		return fingerprint;
+	}
+
 	static const char paramPrefix = '$';
 
+	// parameters the command takes: the highest $n outside strings, comments, quoted
+	// identifiers and dollar quotes, kept up to date by the constructors and operator +=
 	uint32_t parseParamsCount() const {
-		return command_.count(paramPrefix);
+		return placeholders_.max;
 	}
 
 	bool valid() const {
@@ -299,8 +669,78 @@ public:
 	}
 
 private:
+	struct Placeholders {
+		// highest $n in the command
+		uint32_t max = 0U;
+		// where lexing resumes after an append and the highest $n before that point
+		int resume = 0;
+		uint32_t maxBefore = 0U;
+	};
+
+	void appended() {
+		fingerprint_.store(0ULL, std::memory_order_relaxed);
+		lex();
+	}
+
+	// Skips to the bytes that can start a string, comment, quoted identifier, placeholder or
+	// dollar quote and lexes the token there; the identifier characters just before are lexed
+	// too, as E'', a$1 or 1e-3 start earlier. Everything in between is plain words and symbols.
+	// An unterminated string or dollar quote at the end is lexed again on every append.
+	void lex() {
+		const char* s = command_.constData();
+		const size_t n = static_cast<size_t>(command_.size());
+		uint32_t max = placeholders_.maxBefore;
+		size_t lastStart = static_cast<size_t>(placeholders_.resume);
+		uint32_t maxBeforeLast = max;
+		size_t lastEnd = lastStart;
+		for (size_t i = lastStart; ; ) {
+			while (i < n && !PgSqlLexer::isSpecial(s[i])) {
+				++i;
+			}
+			if (i >= n) {
+				break;
+			}
+			size_t start = i;
+			while (start > lastEnd && PgSqlLexer::isIdent(s[start - 1])) {
+				--start;
+			}
+			auto token = PgSqlLexer::next(s, n, start);
+			while (token.end <= i) {
+				start = token.end;
+				token = PgSqlLexer::next(s, n, start);
+			}
+			lastStart = start;
+			maxBeforeLast = max;
+			if (token.kind == PgSqlLexer::Param) {
+				uint64_t index = 0ULL;
+				for (size_t k = start + 1; k < token.end && index <= INT_MAX; ++k) {
+					index = index * 10U + static_cast<uint64_t>(s[k] - '0');
+				}
+				max = static_cast<uint32_t>(std::max<uint64_t>(max, std::min<uint64_t>(index, INT_MAX)));
+			}
+			i = lastEnd = token.end;
+		}
+
+		// appended text can extend only what follows the last space, or else the last token
+		size_t space = n;
+		while (space > lastEnd && !PgSqlLexer::isSpace(s[space - 1])) {
+			--space;
+		}
+		if (space > lastEnd) {
+			placeholders_.resume = static_cast<int>(space);
+			placeholders_.maxBefore = max;
+		} else {
+			placeholders_.resume = static_cast<int>(lastStart);
+			placeholders_.maxBefore = maxBeforeLast;
+		}
+		placeholders_.max = max;
+	}
+
 	QByteArray command_;
 	SqlParameterList params_;
+	Placeholders placeholders_;
+	// 0 until computed
+	mutable std::atomic<uint64_t> fingerprint_;
 };
 
 inline Sql operator + (const Sql& a, const Sql& b) {
@@ -330,12 +770,13 @@ T value(const PGresult* res, uint32_t row, uint32_t column) {
 template<> inline
 QString value<QString>(const PGresult* res, uint32_t row, uint32_t column) {
 	return (!PQgetisnull(res, row, column)) ? 
-		QString::fromLocal8Bit(
+		decodeText(
 			PQgetvalue(res, row, column), 
 			PQgetlength(res, row, column)
 		) : QString();
 }
 
+// the raw bytes in the client encoding, without a copy or conversion
 template<> inline
 QByteArray value<QByteArray>(const PGresult* res, uint32_t row, uint32_t column) {
 	return (!PQgetisnull(res, row, column)) ? 
@@ -373,36 +814,149 @@ inline QString errorMessage(const PGconn* conn_) {
 	return message;
 }
 
+// Live PGresult bytes, per connection and for the whole process.
+// A limit of 0 means unlimited.
+class PgMemoryAccount {
+public:
+	PgMemoryAccount() : bytes_(0LL), limit_(0LL) {}
+
+	int64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+	int64_t limit() const { return limit_.load(std::memory_order_relaxed); }
+
+	void setLimit(int64_t limit) { limit_.store(limit, std::memory_order_relaxed); }
+
+	bool exceeds(int64_t extra) const {
+		const auto max = limit();
+		return max > 0LL && bytes() + extra > max;
+	}
+
+	void add(int64_t size) { bytes_.fetch_add(size, std::memory_order_relaxed); }
+
+	void sub(int64_t size) { bytes_.fetch_sub(size, std::memory_order_relaxed); }
+
+	static PgMemoryAccount& process() {
+		static PgMemoryAccount account;
+		return account;
+	}
+
+private:
+	PgMemoryAccount(const PgMemoryAccount&) = delete;
+	PgMemoryAccount& operator = (const PgMemoryAccount&) = delete;
+
+private:
+	std::atomic<int64_t> bytes_;
+	std::atomic<int64_t> limit_;
+};
+
 class PgResult;
 
 class PgRowColumn {
 public:
-	PgRowColumn(const PgResult* result, uint32_t row, uint32_t column) :
-		result_(result),
+	PgRowColumn() : res_(nullptr), row_(0UL), column_(0UL), n_columns_(0UL) {}
+
+	PgRowColumn(const PGresult* res, uint32_t row, uint32_t column, uint32_t n_columns) :
+		res_(res),
 		row_(row),
-		column_(column) {}
+		column_(column),
+		n_columns_(n_columns) {}
 
-	template<class T>
-	inline T to() const;
+	inline PgRowColumn(const PgResult* result, uint32_t row, uint32_t column);
+
+	template<class T> inline
+	T to() const {
+		return (res_ && column_ < n_columns_) ? ::value<T>(res_, row_, column_) : T();
+	}
+
+	bool isNull() const {
+		return !(res_ && column_ < n_columns_) || PQgetisnull(res_, row_, column_);
+	}
 
-	PgRowColumn& next() { ++row_; return *this;  }
-	PgRowColumn& operator * () { return *this; }
-	PgRowColumn& operator ++ () { return next(); }
+	uint32_t row() const { return row_; }
+	uint32_t column() const { return column_; }
 
-	bool operator == (const PgRowColumn& value)  const { return column_ == value.column_; }
-	bool operator != (const PgRowColumn& value)  const { return !(*this == value); }
+	bool operator == (const PgRowColumn& value) const {
+		return res_ == value.res_ && row_ == value.row_ && column_ == value.column_;
+	}
+	bool operator != (const PgRowColumn& value) const { return !(*this == value); }
 
 private:
-	const PgResult* result_;
+	const PGresult* res_;
 	uint32_t row_;
 	uint32_t column_;
+	uint32_t n_columns_;
+};
+
+class PgRow;
+
+// Random access iterator over the rows of a result (PgRow) or the columns of a row (PgRowColumn).
+// It keeps the raw PGresult and the dimensions, so dereferencing does not go through PgResult.
+// Dereferencing yields a value: for (const auto& row : res), for (auto column : row).
+template<class T>
+class PgIterator {
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using iterator_concept = std::random_access_iterator_tag;
+	using value_type = T;
+	using difference_type = std::ptrdiff_t;
+	using pointer = void;
+	using reference = T;
+
+	PgIterator() : res_(nullptr), row_(0UL), n_columns_(0UL), index_(0) {}
+
+	PgIterator(const PGresult* res, uint32_t row, uint32_t n_columns, difference_type index) :
+		res_(res),
+		row_(row),
+		n_columns_(n_columns),
+		index_(index) {}
+
+	reference operator * () const { return make(index_); }
+	reference operator [] (difference_type n) const { return make(index_ + n); }
+
+	PgIterator& operator ++ () { ++index_; return *this; }
+	PgIterator& operator -- () { --index_; return *this; }
+	PgIterator operator ++ (int) { auto t = *this; ++index_; return t; }
+	PgIterator operator -- (int) { auto t = *this; --index_; return t; }
+	PgIterator& operator += (difference_type n) { index_ += n; return *this; }
+	PgIterator& operator -= (difference_type n) { index_ -= n; return *this; }
+
+	friend PgIterator operator + (PgIterator it, difference_type n) { return it += n; }
+	friend PgIterator operator + (difference_type n, PgIterator it) { return it += n; }
+	friend PgIterator operator - (PgIterator it, difference_type n) { return it -= n; }
+	friend difference_type operator - (const PgIterator& a, const PgIterator& b) { return a.index_ - b.index_; }
+
+	friend bool operator == (const PgIterator& a, const PgIterator& b) {
+		return a.index_ == b.index_ && a.res_ == b.res_ && a.row_ == b.row_;
+	}
+	friend bool operator != (const PgIterator& a, const PgIterator& b) { return !(a == b); }
+	friend bool operator < (const PgIterator& a, const PgIterator& b) { return a.index_ < b.index_; }
+	friend bool operator > (const PgIterator& a, const PgIterator& b) { return b < a; }
+	friend bool operator <= (const PgIterator& a, const PgIterator& b) { return !(b < a); }
+	friend bool operator >= (const PgIterator& a, const PgIterator& b) { return !(a < b); }
+
+private:
+	inline T make(difference_type index) const;
+
+private:
+	const PGresult* res_;
+	uint32_t row_;
+	uint32_t n_columns_;
+	difference_type index_;
 };
 
 class PgRow {
 public:
-    PgRow() : result_(nullptr), row_(0UL) {}
+	using iterator = PgIterator<PgRowColumn>;
+	using const_iterator = iterator;
+
+	PgRow() : res_(nullptr), row_(0UL), n_columns_(0UL) {}
+
+	PgRow(const PGresult* res, uint32_t row, uint32_t n_columns) :
+		res_(res),
+		row_(row),
+		n_columns_(n_columns) {}
 
-	PgRow(const PgResult* result, uint32_t row) : result_(result), row_(row) {}
+	inline PgRow(const PgResult* result, uint32_t row);
 
 	PgRowColumn column(uint32_t column) const { return at(column); }
 	
@@ -411,32 +965,48 @@ public:
 	template<class T> inline
 	T value(uint32_t column) const { return at(column).to<T>(); }
 
-	PgRowColumn at(uint32_t column) const { return PgRowColumn(result_, row_, column); }
+	PgRowColumn at(uint32_t column) const { return PgRowColumn(res_, row_, column, n_columns_); }
 	PgRowColumn operator [] (uint32_t column) const { return at(column); }
-	PgRowColumn begin() const { return at(0); }
-	PgRowColumn end() const { return at(size()); }
-	inline uint32_t size() const;
+	iterator begin() const { return iterator(res_, row_, n_columns_, 0); }
+	iterator end() const { return iterator(res_, row_, n_columns_, size()); }
+	uint32_t size() const { return (res_) ? n_columns_ : 0UL; }
 	bool empty() const { return size() == 0LL; }
 	bool valid() const { return !empty(); }
-	PgRow& next() { ++row_; return *this; }
-	PgRow& operator * () { return *this; }
-	PgRow& operator ++ () { return next();}
-	bool operator == (const PgRow& value)  const { return row_ == value.row_; }
+	uint32_t index() const { return row_; }
+	const PGresult* get() const { return res_; }
+	bool operator == (const PgRow& value)  const { return res_ == value.res_ && row_ == value.row_; }
 	bool operator != (const PgRow& value)  const { return !(*this == value); }
 
 private:
-	const PgResult* result_;
+	const PGresult* res_;
 	uint32_t row_;
+	uint32_t n_columns_;
 };
 
+template<> inline
+PgRow PgIterator<PgRow>::make(difference_type index) const {
+	return PgRow(res_, static_cast<uint32_t>(index), n_columns_);
+}
+
+template<> inline
+PgRowColumn PgIterator<PgRowColumn>::make(difference_type index) const {
+	return PgRowColumn(res_, row_, static_cast<uint32_t>(index), n_columns_);
+}
+
 class PgResult  {
 public:
-	PgResult() : res_(), n_rows_(0UL), n_columns_(0UL) {}
+	using iterator = PgIterator<PgRow>;
+	using const_iterator = iterator;
+
+	PgResult() : res_(), n_rows_(0UL), n_columns_(0UL), account_(), accounted_(0LL), statementKey_(0ULL) {}
 
 	PgResult(PgHandle<PGresult>&& res) :
 		res_(std::move(res)),
 		n_rows_(0UL),
-		n_columns_(0UL)
+		n_columns_(0UL),
+		account_(),
+		accounted_(0LL),
+		statementKey_(0ULL)
 	{
 		if (res_.valid()) {
 			const int n_rows{ PQntuples(res_.get()) };
@@ -448,6 +1018,8 @@ public:
 			else {
 				n_rows_ = n_rows;
 				n_columns_ = n_coumns;
+				accounted_ = static_cast<int64_t>(memoryBytes());
+				PgMemoryAccount::process().add(accounted_);
 			}
 		}
 	}
@@ -455,15 +1027,49 @@ public:
 	PgResult(PgResult&& res) :
 		res_(std::move(res.res_)),
 		n_rows_(res.n_rows_),
-		n_columns_(res.n_columns_) {}
+		n_columns_(res.n_columns_),
+		account_(std::move(res.account_)),
+		accounted_(res.accounted_),
+		statementKey_(res.statementKey_)
+	{
+		res.accounted_ = 0LL;
+	}
 
 	PgResult& operator = (PgResult&& res) {
+		unaccount();
 		res_ = std::move(res.res_);
 		n_rows_ = res.n_rows_;
 		n_columns_ = res.n_columns_;
+		account_ = std::move(res.account_);
+		accounted_ = res.accounted_;
+		res.accounted_ = 0LL;
+		statementKey_ = res.statementKey_;
 		return *this;
 	}
 
+	~PgResult() { unaccount(); }
+
+	// bytes held by the PGresult, including libpq bookkeeping
+	size_t memoryBytes() const { return valid() ? PQresultMemorySize(res_.get()) : 0U; }
+
+	// charges memoryBytes() to account (typically a connection) while the result is alive
+	void setMemoryAccount(const std::shared_ptr<PgMemoryAccount>& account) {
+		if (account_) {
+			account_->sub(accounted_);
+		}
+		account_ = account;
+		if (account_) {
+			account_->add(accounted_);
+		}
+	}
+
+	// Sql::fingerprint of the statement that produced the result, or pgStatementKey of
+	// "EXECUTE name" for a prepared one, set by PgConnection
+	// while exec observers are active, 0 otherwise
+	uint64_t statementKey() const { return statementKey_; }
+
+	void setStatementKey(uint64_t key) { statementKey_ = key; }
+
 	uint32_t rowCount() const { return n_rows_; }
 
 	uint32_t columnCount() const { return n_columns_; }
@@ -483,7 +1089,7 @@ public:
 	}
 
 	template<class T>
-	PgRowColumn value(uint32_t row, uint32_t column) const {
+	T value(uint32_t row, uint32_t column) const {
 		return value(row).value<T>(column);
 	}
 
@@ -492,119 +1098,863 @@ public:
 	uint32_t size() const { return rowCount(); }
 	uint32_t empty() const { return size() == 0LL; }
 	PgRow at(uint32_t index) const {
-		return (index < size()) ? PgRow(this, index) : PgRow();
+		return (index < size()) ? PgRow(res_.get(), index, n_columns_) : PgRow();
 	}
-	PgRow begin() const { return PgRow(this, 0UL); }
-	PgRow end() const { return PgRow(this, size()); }
+	iterator begin() const { return iterator(res_.get(), 0UL, n_columns_, 0); }
+	iterator end() const { return iterator(res_.get(), 0UL, n_columns_, size()); }
 	PgRow front() const { return at(0UL); }
 	PgRow back() const { return at(size() - 1); }
 	PgRow operator [] (uint32_t index) const {
-		return PgRow(this, index);
+		return PgRow(res_.get(), index, n_columns_);
 	}
 
 private:
 	PgResult(const PgResult& res) = delete;
 	PgResult& operator = (const PgResult& res) = delete;
 
+	void unaccount() {
+		if (accounted_) {
+			PgMemoryAccount::process().sub(accounted_);
+			if (account_) {
+				account_->sub(accounted_);
+			}
+			accounted_ = 0LL;
+		}
+		account_.reset();
+	}
+
 private:
 	PgHandle<PGresult> res_;
 	uint32_t n_rows_;
 	uint32_t n_columns_;
+	std::shared_ptr<PgMemoryAccount> account_;
+	int64_t accounted_;
+	uint64_t statementKey_;
 };
 
-template<class T> inline
-T PgRowColumn::to() const {
-	return (result_ && column_ < result_->columnCount()) ?
-		::value<T>(result_->get(), row_, column_) : T();
+inline PgRowColumn::PgRowColumn(const PgResult* result, uint32_t row, uint32_t column) :
+	res_(result ? result->get() : nullptr),
+	row_(row),
+	column_(column),
+	n_columns_(result ? result->columnCount() : 0UL) {}
+
+inline PgRow::PgRow(const PgResult* result, uint32_t row) :
+	res_(result ? result->get() : nullptr),
+	row_(row),
+	n_columns_(result ? result->columnCount() : 0UL) {}
+
+#ifdef _WIN32
+using PgPollFd = WSAPOLLFD;
+
+inline int pollSockets(PgPollFd* fds, size_t n, int timeoutMs) {
+	return WSAPoll(fds, static_cast<ULONG>(n), timeoutMs);
 }
+#else
+using PgPollFd = pollfd;
 
-inline uint32_t PgRow::size() const {
-	return (result_) ? result_->columnCount() : 0UL;
+inline int pollSockets(PgPollFd* fds, size_t n, int timeoutMs) {
+	return poll(fds, static_cast<nfds_t>(n), timeoutMs);
 }
+#endif
 
-inline PgHandle<PGresult> exec(PGconn* conn, const Sql& sql_, QString* error = nullptr) {
-    auto errorReport = [error](const QString& message) {
-		qWarning() << message;
-		if (error) {
-			*error = message;
-		}
-		return nullptr;
-	};
+// 64-bit FNV-1a of the raw text; prepared statements are keyed by this of "EXECUTE name"
+inline uint64_t pgStatementKey(const QByteArray& command, uint64_t h = 14695981039346656037ULL) {
+	for (char c : command) {
+		h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+	}
+	return h;
+}
 
-	auto isFailStatus = [](ExecStatusType status) {
-		return (status != PGRES_COMMAND_OK) && (status != PGRES_TUPLES_OK);
-	};
+// Cheap timestamps for phase timing: the TSC on x86, the virtual counter on ARM64 and
+// steady_clock nanoseconds elsewhere. The tick rate is measured once, over about 2 ms.
+class PgTsc {
+public:
+	static uint64_t now() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#elif defined(__aarch64__)
+		uint64_t ticks;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+		return ticks;
+#else
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+	}
 
-	if (!sql_.valid()) {
-		return errorReport("Sql - Too many parameters");
+	static uint64_t toNs(uint64_t ticks) {
+		static const double nsPerTick = calibrate();
+		return static_cast<uint64_t>(ticks * nsPerTick);
 	}
 
-    const auto& params = sql_.params();
-    const auto& vparams = params.params();
-    const auto n_params = params.size();
-    const bool is_params = (n_params > size_t());
-	
-	sql_.debug();
+private:
+	static double calibrate() {
+		const auto start = std::chrono::steady_clock::now();
+		const uint64_t ticks = now();
+		auto end = start;
+		while (end - start < std::chrono::milliseconds(2)) {
+			end = std::chrono::steady_clock::now();
+		}
+		const uint64_t elapsed = now() - ticks;
+		return elapsed ? std::chrono::duration<double, std::nano>(end - start).count() / elapsed : 1.0;
+	}
+};
 
-	auto result = makePgHandle(PQexecParams(
-		conn, sql_.c_command(),
-        static_cast<int>(n_params),
-		nullptr,
-		(is_params) ? v_convert(vparams, [](const QByteArray& data) { return data.data(); }).data() : nullptr,
-        (is_params) ? v_convert(vparams, [](const QByteArray& data) { return static_cast<int>(data.size()); }).data() : nullptr,
-        (is_params) ? params.formats().data() : nullptr,
-        1
-	));
+// Splits every observed ::exec into the phases of PgPhases, at the cost of four PgTsc reads
+// and a poll for the first byte. Off by default.
+inline std::atomic<bool>& pgPhaseTimingStorage() {
+	static std::atomic<bool> enabled(false);
+	return enabled;
+}
 
-	if (!result.get()) {
-		return errorReport("PGresult - invalid result handle");
-	}
+inline bool pgPhaseTiming() { return pgPhaseTimingStorage().load(std::memory_order_relaxed); }
 
-	if (isFailStatus(PQresultStatus(result.get()))) {
-		return errorReport(QString("PGresult - ") + QString(PQresultErrorMessage(result.get())) );
-	}
+inline void setPgPhaseTiming(bool enabled) { pgPhaseTimingStorage().store(enabled); }
 
-    return result;
+// Where the time of an exec went
+struct PgPhases {
+	// parameter pointer and length arrays
+	uint64_t buildNs;
+	// until the query is written to the socket
+	uint64_t sendNs;
+	// until the first byte of the answer arrives: server execution plus a round trip
+	uint64_t firstByteNs;
+	// until the whole result is read and parsed by libpq
+	uint64_t receiveNs;
+};
+
+// Heap allocations made by the calling thread. Counting is opt-in: exactly one translation
+// unit of the executable defines T_PG_ALLOC_TRACKING_IMPLEMENTATION before including t_pg.h,
+// which replaces the global operator new and, with glibc, malloc/calloc/realloc (where
+// QByteArray and QString allocate). Otherwise the counters stay at 0.
+struct PgAllocCounters {
+	uint64_t allocations;
+	uint64_t bytes;
+};
+
+inline PgAllocCounters& pgThreadAllocations() {
+	static thread_local PgAllocCounters counters{ 0ULL, 0ULL };
+	return counters;
 }
 
-class PgConnection {
+inline bool& pgAllocTrackingStorage() {
+	static bool linked = false;
+	return linked;
+}
+
+// true when the counting allocator is linked in
+inline bool pgAllocTracking() { return pgAllocTrackingStorage(); }
+
+enum class PgEventKind {
+	// one statement, from ::exec, ::execPrepared or PgConnection::exec
+	Exec,
+	// one PgDecodeScope, reading values out of a result
+	Decode,
+	// a connection handshake, from connectStart or connectPoll
+	Connect,
+	// one chunk of a streamed result handed to a PgConnection overflow handler
+	Chunk,
+	// a PgPool checkout that had to queue
+	PoolWait
+};
+
+// What exec observers receive. For Exec, sql is null for prepared statements, name is null
+// otherwise, result is null on failure and phases is set while pgPhaseTiming() is on.
+// The other kinds are spans: only conn (when known), result (Decode, Chunk), key (Decode),
+// start and end are set.
+struct PgExecEvent {
+	PgEventKind kind;
+	const PGconn* conn;
+	const Sql* sql;
+	const QByteArray* name;
+	const SqlParameterList* params;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point end;
+	const PGresult* result;
+	// Sql::fingerprint of the command, or pgStatementKey of "EXECUTE name"
+	uint64_t key;
+	const PgPhases* phases;
+	// heap allocations on the calling thread between start and end, see pgAllocTracking()
+	uint64_t allocations;
+	uint64_t allocatedBytes;
+};
+
+using PgExecObserver = void (*)(const PgExecEvent& event, void* context);
+
+// Process-wide observers of every exec, called on the executing thread.
+// Without observers an exec pays one relaxed load. An observer may be removed while
+// execs run, but its context must outlive the execs already in flight.
+class PgExecObservers {
 public:
-	PgConnection() : 
-		conn_(),
-		errorMessage_() {
+	static constexpr int kMax = 8;
+
+	static PgExecObservers& instance() {
+		static PgExecObservers observers;
+		return observers;
 	}
 
-	PgConnection(const QString& conStr) : 
-		conn_(makePgHandle(PQconnectdb(conStr.toLocal8Bit()))),
-		errorMessage_() 
-	{
-		if (validate()) {
-			if (PQsetClientEncoding(conn_.get(), "WIN1251") != 0) {
-				qWarning() << "error PQsetClientEncoding";
+	bool add(PgExecObserver fn, void* context) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto& slot : slots_) {
+			if (slot.fn.load() == nullptr) {
+				slot.context.store(context);
+				slot.fn.store(fn);
+				active_.fetch_add(1);
+				return true;
 			}
 		}
+		qWarning() << "PgExecObservers - no free slot";
+		return false;
 	}
 
-	PgConnection(PgConnection&& rvalue) :
-		conn_(std::move(rvalue.conn_)),
-		errorMessage_(std::move(rvalue.errorMessage_))
-	{}
+	void remove(PgExecObserver fn, void* context) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto& slot : slots_) {
+			if (slot.fn.load() == fn && slot.context.load() == context) {
+				slot.fn.store(nullptr);
+				slot.context.store(nullptr);
+				active_.fetch_sub(1);
+			}
+		}
+	}
+
+	bool active() const { return active_.load(std::memory_order_relaxed) != 0; }
+
+	void notify(const PgExecEvent& event) const {
+		for (const auto& slot : slots_) {
+			void* context = slot.context.load(std::memory_order_acquire);
+			if (PgExecObserver fn = slot.fn.load(std::memory_order_acquire)) {
+				fn(event, context);
+			}
+		}
+	}
+
+private:
+	PgExecObservers() : slots_(), active_(0), mutex_() {}
+
+	struct Slot {
+		std::atomic<PgExecObserver> fn{ nullptr };
+		std::atomic<void*> context{ nullptr };
+	};
+
+	Slot slots_[kMax];
+	std::atomic<int> active_;
+	std::mutex mutex_;
+};
+
+// Times one exec and notifies the observers when it goes out of scope,
+// with the result passed to done() or as a failure.
+class PgExecTrace {
+public:
+	PgExecTrace(const PGconn* conn, const Sql* sql_, const QByteArray* name, const SqlParameterList* params) :
+		active_(PgExecObservers::instance().active()),
+		event_{ PgEventKind::Exec, conn, sql_, name, params, {}, {}, nullptr, 0ULL, nullptr, 0ULL, 0ULL },
+		phases_(),
+		allocated_(pgThreadAllocations())
+	{
+		if (active_) {
+			event_.key = sql_ ? sql_->fingerprint() : pgStatementKey(*name, pgStatementKey("EXECUTE "));
+			if (pgPhaseTiming()) {
+				event_.phases = &phases_;
+			}
+			allocated_ = pgThreadAllocations();
+			event_.start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~PgExecTrace() {
+		if (active_) {
+			event_.end = std::chrono::steady_clock::now();
+			event_.allocations = pgThreadAllocations().allocations - allocated_.allocations;
+			event_.allocatedBytes = pgThreadAllocations().bytes - allocated_.bytes;
+			PgExecObservers::instance().notify(event_);
+		}
+	}
+
+	// res must stay alive until the trace is destroyed
+	void done(const PGresult* res) { event_.result = res; }
+
+	// to be filled in while phase timing is on, nullptr otherwise
+	PgPhases* phases() { return event_.phases ? &phases_ : nullptr; }
+
+private:
+	PgExecTrace(const PgExecTrace&) = delete;
+	PgExecTrace& operator = (const PgExecTrace&) = delete;
+
+	bool active_;
+	PgExecEvent event_;
+	PgPhases phases_;
+	PgAllocCounters allocated_;
+};
+
+// Times reading values out of a result and reports it to the exec observers under the
+// statement the result came from, so decode cost shows up next to the exec phases.
+//
+// PgResult res = conn.exec(sql);
+// {
+//     PgDecodeScope decode(res);
+//     for (const auto& row : res) { ... }
+// }
+class PgDecodeScope {
+public:
+	explicit PgDecodeScope(const PgResult& res) :
+		active_(PgExecObservers::instance().active()),
+		event_{ PgEventKind::Decode, nullptr, nullptr, nullptr, nullptr, {}, {}, res.get(), res.statementKey(), nullptr, 0ULL, 0ULL },
+		allocated_(pgThreadAllocations())
+	{
+		if (active_) {
+			event_.start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~PgDecodeScope() {
+		if (active_) {
+			event_.end = std::chrono::steady_clock::now();
+			event_.allocations = pgThreadAllocations().allocations - allocated_.allocations;
+			event_.allocatedBytes = pgThreadAllocations().bytes - allocated_.bytes;
+			PgExecObservers::instance().notify(event_);
+		}
+	}
+
+private:
+	PgDecodeScope(const PgDecodeScope&) = delete;
+	PgDecodeScope& operator = (const PgDecodeScope&) = delete;
+
+	bool active_;
+	PgExecEvent event_;
+	PgAllocCounters allocated_;
+};
+
+// A span of the given kind reported to the exec observers when it goes out of scope
+class PgSpan {
+public:
+	PgSpan(PgEventKind kind, const PGconn* conn, const PGresult* res = nullptr) :
+		active_(PgExecObservers::instance().active()),
+		event_{ kind, conn, nullptr, nullptr, nullptr, {}, {}, res, 0ULL, nullptr, 0ULL, 0ULL }
+	{
+		if (active_) {
+			event_.start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~PgSpan() {
+		if (active_) {
+			event_.end = std::chrono::steady_clock::now();
+			PgExecObservers::instance().notify(event_);
+		}
+	}
+
+	void setConnection(const PGconn* conn) { event_.conn = conn; }
+
+private:
+	PgSpan(const PgSpan&) = delete;
+	PgSpan& operator = (const PgSpan&) = delete;
+
+	bool active_;
+	PgExecEvent event_;
+};
+
+// True where PQexec stops reading results: COPY waits for the caller and a broken connection sends no more
+inline bool isLastResult(PGconn* conn, const PGresult* res) {
+	const auto status = PQresultStatus(res);
+	return status == PGRES_COPY_IN || status == PGRES_COPY_OUT || status == PGRES_COPY_BOTH ||
+		PQstatus(conn) == CONNECTION_BAD;
+}
+
+// PQexecParams taken apart so that each phase can be timed; same result.
+// Like PQexecParams it waits for the server without a timeout, statement_timeout bounds both.
+inline PgHandle<PGresult> execPhased(PGconn* conn, const Sql& sql_, PgPhases& phases) {
+	const auto& params = sql_.params();
+	const auto& vparams = params.params();
+	const auto n_params = params.size();
+
+	uint64_t t0 = PgTsc::now();
+	std::vector<const char*> values;
+	std::vector<int> lengths;
+	values.reserve(n_params);
+	lengths.reserve(n_params);
+	for (const auto& data : vparams) {
+		values.push_back(data.constData());
+		lengths.push_back(static_cast<int>(data.size()));
+	}
+	uint64_t t1 = PgTsc::now();
+	phases.buildNs = PgTsc::toNs(t1 - t0);
+
+	const int sent = PQsendQueryParams(
+		conn, sql_.c_command(),
+		static_cast<int>(n_params),
+		nullptr,
+		n_params ? values.data() : nullptr,
+		n_params ? lengths.data() : nullptr,
+		n_params ? params.formats().data() : nullptr,
+		1
+	);
+	t0 = PgTsc::now();
+	phases.sendNs = PgTsc::toNs(t0 - t1);
+	if (!sent) {
+		return nullptr;
+	}
+
+	// only marks the first byte, PQgetResult below does the waiting; skipped without a socket,
+	// where poll would never return
+	PgPollFd fd{};
+	fd.fd = PQsocket(conn);
+	fd.events = POLLIN;
+	if (fd.fd >= 0 && PQisBusy(conn)) {
+		pollSockets(&fd, 1U, -1);
+	}
+	t1 = PgTsc::now();
+	phases.firstByteNs = PgTsc::toNs(t1 - t0);
+
+	// like PQexecParams: the first error wins, otherwise the last result
+	PgHandle<PGresult> result;
+	for (;;) {
+		auto next = makePgHandle(PQgetResult(conn));
+		if (!next) {
+			break;
+		}
+		const bool last = isLastResult(conn, next.get());
+		const auto kept = result.valid() ? PQresultStatus(result.get()) : PGRES_COMMAND_OK;
+		if (kept == PGRES_COMMAND_OK || kept == PGRES_TUPLES_OK) {
+			result = std::move(next);
+		}
+		if (last) {
+			break;
+		}
+	}
+	phases.receiveNs = PgTsc::toNs(PgTsc::now() - t1);
+	return result;
+}
+
+inline PgHandle<PGresult> exec(PGconn* conn, const Sql& sql_, QString* error = nullptr) {
+    auto errorReport = [error](const QString& message) {
+		qWarning() << message;
+		if (error) {
+			*error = message;
+		}
+		return nullptr;
+	};
+
+	auto isFailStatus = [](ExecStatusType status) {
+		return (status != PGRES_COMMAND_OK) && (status != PGRES_TUPLES_OK);
+	};
+
+	PgExecTrace trace(conn, &sql_, nullptr, &sql_.params());
+
+	if (!sql_.valid()) {
+		return errorReport("Sql - Too many parameters");
+	}
+
+    const auto& params = sql_.params();
+    const auto& vparams = params.params();
+    const auto n_params = params.size();
+    const bool is_params = (n_params > size_t());
+	
+	sql_.debug();
+
+	PgHandle<PGresult> result;
+	if (PgPhases* phases = trace.phases()) {
+		result = execPhased(conn, sql_, *phases);
+	} else {
+		result = makePgHandle(PQexecParams(
+			conn, sql_.c_command(),
+			static_cast<int>(n_params),
+			nullptr,
+			(is_params) ? v_convert(vparams, [](const QByteArray& data) { return data.data(); }).data() : nullptr,
+			(is_params) ? v_convert(vparams, [](const QByteArray& data) { return static_cast<int>(data.size()); }).data() : nullptr,
+			(is_params) ? params.formats().data() : nullptr,
+			1
+		));
+	}
+
+	if (!result.get()) {
+		return errorReport("PGresult - invalid result handle");
+	}
+
+	if (isFailStatus(PQresultStatus(result.get()))) {
+		return errorReport(QString("PGresult - ") + QString(PQresultErrorMessage(result.get())) );
+	}
+
+	trace.done(result.get());
+    return result;
+}
+
+// execPrepared(conn, "find_user", SqlParameterList().arg(name))
+inline PgHandle<PGresult> execPrepared(PGconn* conn, const QByteArray& name, const SqlParameterList& params, QString* error = nullptr) {
+	auto errorReport = [error](const QString& message) {
+		qWarning() << message;
+		if (error) {
+			*error = message;
+		}
+		return nullptr;
+	};
+
+	PgExecTrace trace(conn, nullptr, &name, &params);
+
+	const auto& vparams = params.params();
+	const auto n_params = params.size();
+	const bool is_params = (n_params > size_t());
+
+	if (n_params >= INT_MAX || n_params != params.formats().size()) {
+		return errorReport("Sql - Too many parameters");
+	}
+
+	auto result = makePgHandle(PQexecPrepared(
+		conn, name.constData(),
+		static_cast<int>(n_params),
+		(is_params) ? v_convert(vparams, [](const QByteArray& data) { return data.data(); }).data() : nullptr,
+		(is_params) ? v_convert(vparams, [](const QByteArray& data) { return static_cast<int>(data.size()); }).data() : nullptr,
+		(is_params) ? params.formats().data() : nullptr,
+		1
+	));
+
+	if (!result.get()) {
+		return errorReport("PGresult - invalid result handle");
+	}
+
+	const auto status = PQresultStatus(result.get());
+	if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+		return errorReport(QString("PGresult - ") + QString(PQresultErrorMessage(result.get())));
+	}
+
+	trace.done(result.get());
+	return result;
+}
+
+// Starts the query without waiting for the result; read it with PQgetResult
+inline bool send(PGconn* conn, const Sql& sql_, QString* error = nullptr) {
+	auto errorReport = [error](const QString& message) {
+		qWarning() << message;
+		if (error) {
+			*error = message;
+		}
+		return false;
+	};
+
+	if (!sql_.valid()) {
+		return errorReport("Sql - Too many parameters");
+	}
+
+	const auto& params = sql_.params();
+	const auto& vparams = params.params();
+	const auto n_params = params.size();
+	const bool is_params = (n_params > size_t());
+
+	sql_.debug();
+
+	const int sent = PQsendQueryParams(
+		conn, sql_.c_command(),
+		static_cast<int>(n_params),
+		nullptr,
+		(is_params) ? v_convert(vparams, [](const QByteArray& data) { return data.data(); }).data() : nullptr,
+		(is_params) ? v_convert(vparams, [](const QByteArray& data) { return static_cast<int>(data.size()); }).data() : nullptr,
+		(is_params) ? params.formats().data() : nullptr,
+		1
+	);
+
+	if (!sent) {
+		return errorReport(QString("PGconn - ") + QString(PQerrorMessage(conn)));
+	}
+
+	return true;
+}
+
+inline void cancel(PGconn* conn) {
+	if (PGcancel* c = PQgetCancel(conn)) {
+		char buffer[256];
+		if (!PQcancel(c, buffer, sizeof(buffer))) {
+			qWarning() << "PGcancel -" << buffer;
+		}
+		PQfreeCancel(c);
+	}
+}
+
+// client_encoding (see PgTextEncoding) goes into the startup packet instead of a separate round trip;
+// a client_encoding in conStr takes precedence
+inline PgHandle<PGconn> connectStart(const QString& conStr, bool nonBlocking = false) {
+	const QByteArray conninfo = conStr.toLocal8Bit();
+	const char* keywords[] = { "client_encoding", "dbname", nullptr };
+	const char* values[] = { pgClientEncoding(), conninfo.constData(), nullptr };
+	if (nonBlocking) {
+		return makePgHandle(PQconnectStartParams(keywords, values, 1));
+	}
+	PgSpan span(PgEventKind::Connect, nullptr);
+	auto conn = makePgHandle(PQconnectdbParams(keywords, values, 1));
+	span.setConnection(conn.get());
+	return conn;
+}
+
+// Drives the handshakes of connections from connectStart(conStr, true) concurrently on this thread.
+// Returns when every handshake has finished or after timeoutMs; check the result with PQstatus.
+inline void connectPoll(const std::vector<PGconn*>& conns, int timeoutMs = 10000) {
+	// a fresh connection waits for its socket to become writable
+	std::vector<PostgresPollingStatusType> states(conns.size(), PGRES_POLLING_WRITING);
+	for (size_t i = 0; i < conns.size(); ++i) {
+		if (!conns[i] || PQstatus(conns[i]) == CONNECTION_BAD) {
+			states[i] = PGRES_POLLING_FAILED;
+		}
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = start + std::chrono::milliseconds(timeoutMs);
+	// one Connect span per handshake, from the first poll until it finished
+	auto finished = [&](size_t i) {
+		if (PgExecObservers::instance().active()) {
+			PgExecEvent event{ PgEventKind::Connect, conns[i], nullptr, nullptr, nullptr,
+				start, std::chrono::steady_clock::now(), nullptr, 0ULL, nullptr, 0ULL, 0ULL };
+			PgExecObservers::instance().notify(event);
+		}
+	};
+	std::vector<PgPollFd> fds;
+	std::vector<size_t> index;
+	for (;;) {
+		fds.clear();
+		index.clear();
+		for (size_t i = 0; i < conns.size(); ++i) {
+			if (states[i] == PGRES_POLLING_READING || states[i] == PGRES_POLLING_WRITING) {
+				PgPollFd fd{};
+				fd.fd = PQsocket(conns[i]);
+				fd.events = (states[i] == PGRES_POLLING_READING) ? POLLIN : POLLOUT;
+				fds.push_back(fd);
+				index.push_back(i);
+			}
+		}
+		if (fds.empty()) {
+			return;
+		}
+
+		const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (left <= 0) {
+			qWarning() << "PGconn - connection timeout";
+			return;
+		}
+		if (pollSockets(fds.data(), fds.size(), static_cast<int>(left)) < 0) {
+			// a signal interrupted the wait: poll again for the time that is left
+			if (errno == EINTR) {
+				continue;
+			}
+			qWarning() << "PGconn - poll failed";
+			return;
+		}
+
+		for (size_t k = 0; k < fds.size(); ++k) {
+			if (fds[k].revents) {
+				states[index[k]] = PQconnectPoll(conns[index[k]]);
+				if (states[index[k]] == PGRES_POLLING_OK || states[index[k]] == PGRES_POLLING_FAILED) {
+					finished(index[k]);
+				}
+			}
+		}
+	}
+}
+
+// Reconnect attempts made when a connection is found broken, waiting backoff before the
+// first retry and doubling it up to maxBackoff, with jitter so clients do not retry in lockstep.
+// attempts = 0, the default, disables reconnecting. The attempts and their backoff sleeps run
+// on the calling thread inside validate() and so inside exec.
+//
+// conn.setReconnectPolicy(PgReconnectPolicy(3));
+struct PgReconnectPolicy {
+	PgReconnectPolicy(
+		int attempts_ = 0,
+		std::chrono::milliseconds backoff_ = std::chrono::milliseconds(100),
+		std::chrono::milliseconds maxBackoff_ = std::chrono::seconds(5)
+	) :
+		attempts(attempts_),
+		backoff(backoff_),
+		maxBackoff(maxBackoff_) {}
+
+	int attempts;
+	std::chrono::milliseconds backoff;
+	std::chrono::milliseconds maxBackoff;
+};
+
+class PgConnection {
+public:
+	PgConnection() : 
+		conn_(),
+		errorMessage_(),
+		memory_(std::make_shared<PgMemoryAccount>()),
+		overflow_(),
+		reconnect_(),
+		session_(),
+		prepared_() {
+	}
+
+	PgConnection(const QString& conStr) : 
+		PgConnection(connectStart(conStr))
+	{}
+
+	// takes over an established connection, e.g. one finished by connectPoll
+	PgConnection(PgHandle<PGconn>&& conn) : 
+		conn_(std::move(conn)),
+		errorMessage_(),
+		memory_(std::make_shared<PgMemoryAccount>()),
+		overflow_(),
+		reconnect_(),
+		session_(),
+		prepared_()
+	{
+		errorMessage_ = ::errorMessage(conn_.get());
+	}
+
+	// Opens n connections with all handshakes in flight at once, so startup
+	// takes about one handshake regardless of n. Failed ones are returned invalid.
+	//
+	// auto conns = PgConnection::connectMany("host=db dbname=app", 64);
+	static std::vector<PgConnection> connectMany(const QString& conStr, size_t n, int timeoutMs = 10000) {
+		std::vector<PgHandle<PGconn>> handles;
+		handles.reserve(n);
+		for (size_t i = 0; i < n; ++i) {
+			handles.push_back(connectStart(conStr, true));
+		}
+
+		connectPoll(v_convert(handles, [](const PgHandle<PGconn>& conn) { return conn.get(); }), timeoutMs);
+
+		std::vector<PgConnection> conns;
+		conns.reserve(n);
+		for (auto& handle : handles) {
+			conns.emplace_back(std::move(handle));
+		}
+		return conns;
+	}
+
+	PgConnection(PgConnection&& rvalue) :
+		conn_(std::move(rvalue.conn_)),
+		errorMessage_(std::move(rvalue.errorMessage_)),
+		memory_(std::move(rvalue.memory_)),
+		overflow_(std::move(rvalue.overflow_)),
+		reconnect_(rvalue.reconnect_),
+		session_(std::move(rvalue.session_)),
+		prepared_(std::move(rvalue.prepared_))
+	{
+		rvalue.memory_ = std::make_shared<PgMemoryAccount>();
+	}
 
 	PgConnection& operator = (PgConnection&& rvalue) {
 		errorMessage_ = std::move(rvalue.errorMessage_);
 		conn_ = std::move(rvalue.conn_);
+		std::swap(memory_, rvalue.memory_);
+		overflow_ = std::move(rvalue.overflow_);
+		reconnect_ = rvalue.reconnect_;
+		session_ = std::move(rvalue.session_);
+		prepared_ = std::move(rvalue.prepared_);
 		return *this;
 	}
 
+	// false after a failed connect or a failed exec, until the next successful validate()
 	bool valid() const { return errorMessage_.isEmpty(); }
 
+	// Checks the connection and reconnects a broken one according to the reconnect policy.
+	// An error of the previous exec is cleared.
 	bool validate() {
-		if (valid()) {
-			errorMessage_ = ::errorMessage(conn_.get());
+		errorMessage_ = ::errorMessage(conn_.get());
+		if (!valid() && conn_.valid() && reconnect_.attempts > 0) {
+			reconnect();
 		}
 		return valid();
 	}
 
+	// Resets the connection with the original parameters, then replays the session setup.
+	// Prepared statements are prepared again on their next use, not all at once.
+	bool reconnect() {
+		auto backoff = reconnect_.backoff;
+		for (int attempt = 0; attempt < std::max(reconnect_.attempts, 1); ++attempt) {
+			if (attempt > 0) {
+				static thread_local std::mt19937 random(std::random_device{}());
+				const auto jitter = std::uniform_int_distribution<long long>(0, backoff.count() / 2)(random);
+				std::this_thread::sleep_for(backoff / 2 + std::chrono::milliseconds(jitter));
+				backoff = std::min(backoff * 2, reconnect_.maxBackoff);
+			}
+			PQreset(conn_.get());
+			errorMessage_ = ::errorMessage(conn_.get());
+			if (valid()) {
+				break;
+			}
+		}
+		if (!valid()) {
+			return false;
+		}
+
+		for (auto& statement : prepared_) {
+			statement.second.prepared = false;
+		}
+		for (const auto& setup : session_) {
+			if (!::exec(conn_.get(), setup, &errorMessage_).valid()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// reconnecting is off until a policy with attempts is set; with one, an exec on a broken
+	// connection blocks for the reconnect attempts and their backoff
+	void setReconnectPolicy(const PgReconnectPolicy& policy) { reconnect_ = policy; }
+
+	// Runs a statement now and again after every reconnect, so it must be idempotent.
+	//
+	// conn.addSessionSetup(Sql("SET search_path TO app, public"));
+	bool addSessionSetup(const Sql& sql_) {
+		session_.push_back(sql_);
+		return validate() && ::exec(conn_.get(), sql_, &errorMessage_).valid();
+	}
+
+	// conn.setSessionParameter("statement_timeout", "5s");
+	bool setSessionParameter(const QByteArray& name, const QByteArray& value) {
+		return addSessionSetup(Sql("SELECT set_config($1, $2, false)").arg(name.constData()).arg(value.constData()));
+	}
+
+	// Registers a named statement; it is prepared on the server at its first execPrepared
+	// and again lazily after a reconnect.
+	//
+	// conn.prepare("find_user", Sql("SELECT id FROM users WHERE name = $1"));
+	// conn.execPrepared("find_user", SqlParameterList().arg(name));
+	void prepare(const QByteArray& name, const Sql& sql_) {
+		auto it = prepared_.find(name);
+		if (it != prepared_.end()) {
+			if (it->second.command == sql_.command()) {
+				return;
+			}
+			if (it->second.prepared) {
+				deallocate(name);
+			}
+		}
+		prepared_[name] = PreparedStatement{ sql_.command(), false };
+	}
+
+	bool isPrepared(const QByteArray& name) const {
+		auto it = prepared_.find(name);
+		return it != prepared_.end() && it->second.prepared;
+	}
+
+	PgResult execPrepared(const QByteArray& name, const SqlParameterList& params = SqlParameterList()) {
+		PgResult res;
+		auto it = prepared_.find(name);
+		if (it == prepared_.end()) {
+			errorMessage_ = QString("PgConnection - unknown prepared statement ") + QString(name);
+			qWarning() << errorMessage_;
+			return res;
+		}
+		if (!validate()) {
+			return res;
+		}
+		if (!it->second.prepared) {
+			auto prepared = makePgHandle(PQprepare(conn_.get(), name.constData(), it->second.command.constData(), 0, nullptr));
+			if (!prepared.get() || PQresultStatus(prepared.get()) != PGRES_COMMAND_OK) {
+				errorMessage_ = QString("PGresult - ") + QString(prepared.get() ? PQresultErrorMessage(prepared.get()) : PQerrorMessage(conn_.get()));
+				qWarning() << errorMessage_;
+				return res;
+			}
+			it->second.prepared = true;
+		}
+		res = std::move(::execPrepared(conn_.get(), name, params, &errorMessage_));
+		res.setMemoryAccount(memory_);
+		if (PgExecObservers::instance().active()) {
+			res.setStatementKey(pgStatementKey(name, pgStatementKey("EXECUTE ")));
+		}
+		return res;
+	}
+
 	bool operator ! () const { return !valid(); }
 
 	QString errorMessage() const { return errorMessage_; }
@@ -613,20 +1963,366 @@ public:
 	PgResult exec(const Sql& sql_) {
         PgResult res;
         if(validate()) {
-			res = std::move(::exec(conn_.get(), sql_, &errorMessage_));
+			if (memory_->limit() > 0LL || PgMemoryAccount::process().limit() > 0LL) {
+				res = execLimited(sql_);
+			} else {
+				res = std::move(::exec(conn_.get(), sql_, &errorMessage_));
+			}
+			res.setMemoryAccount(memory_);
+			if (PgExecObservers::instance().active()) {
+				res.setStatementKey(sql_.fingerprint());
+			}
         }
 		return res;
 	}
 
+	// Starts a statement without waiting for it, so several connections can run at once.
+	// Read the result with collect() whenever the socket is readable, see PgShardRouter::execAll.
+	bool send(const Sql& sql_) {
+		return validate() && ::send(conn_.get(), sql_, &errorMessage_);
+	}
+
+	// Reads what arrived after send() without blocking; true while the statement is still running.
+	// Like exec the first error wins, otherwise res gets the last result. The result is charged
+	// to this connection's memory account but, unlike exec, never read row by row for the limit.
+	bool collect(PgResult& res) {
+		PGconn* conn = conn_.get();
+		if (!PQconsumeInput(conn)) {
+			errorMessage_ = QString("PGconn - ") + QString(PQerrorMessage(conn));
+			qWarning() << errorMessage_;
+			return false;
+		}
+		while (!PQisBusy(conn)) {
+			auto next = makePgHandle(PQgetResult(conn));
+			if (!next) {
+				return false;
+			}
+			const auto status = PQresultStatus(next.get());
+			const bool last = isLastResult(conn, next.get());
+			if (!errorMessage_.isEmpty()) {
+				// an earlier result failed, the rest only has to be read
+			} else if (status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK) {
+				res = PgResult(std::move(next));
+				res.setMemoryAccount(memory_);
+			} else {
+				const char* message = PQresultErrorMessage(next.get());
+				errorMessage_ = QString("PGresult - ") + QString(*message ? message : PQresStatus(status));
+				qWarning() << errorMessage_;
+				res = PgResult();
+			}
+			if (last) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Cancels a statement from send() and reads the rest of its results, blocking until the server
+	// has stopped; errorMessage() is the cancel error unless an earlier one was set.
+	void cancelPending() {
+		PGconn* conn = conn_.get();
+		::cancel(conn);
+		for (;;) {
+			auto next = makePgHandle(PQgetResult(conn));
+			if (!next) {
+				break;
+			}
+			if (errorMessage_.isEmpty() && PQresultStatus(next.get()) == PGRES_FATAL_ERROR) {
+				errorMessage_ = QString("PGresult - ") + QString(PQresultErrorMessage(next.get()));
+			}
+			if (isLastResult(conn, next.get())) {
+				break;
+			}
+		}
+		if (errorMessage_.isEmpty()) {
+			errorMessage_ = "PgConnection - statement cancelled";
+		}
+	}
+
+	// bytes of all live results returned by this connection
+	int64_t memoryBytes() const { return memory_->bytes(); }
+
+	int64_t memoryLimit() const { return memory_->limit(); }
+
+	// Caps memoryBytes(), 0 disables. A result that would cross the limit is read row by row;
+	// without an overflow handler the query is cancelled and exec fails,
+	// otherwise the rows read so far and all following rows are passed to overflow
+	// in chunks and exec returns an empty result. overflow returns false to cancel the query
+	// and exec fails with the server's cancel message.
+	//
+	// The size of a result is not known before it arrives, so while this limit or the process
+	// limit is set every exec reads in single-row mode and copies each row into the result,
+	// which costs about as much again as receiving it. Set it on connections that run queries
+	// able to reach it, not on every connection.
+	//
+	// conn.setMemoryLimit(256 << 20, [&](PgResult&& chunk) { write(chunk); return true; });
+	void setMemoryLimit(int64_t bytes, std::function<bool(PgResult&&)> overflow = {}) {
+		memory_->setLimit(bytes);
+		overflow_ = std::move(overflow);
+	}
+
 	PGconn* get() const { return conn_.get(); }
 
 private:
 	PgConnection(const PgConnection& res) = delete;
 	PgConnection& operator = (const PgConnection& res) = delete;
 
+	void deallocate(const QByteArray& name) {
+		if (char* id = PQescapeIdentifier(conn_.get(), name.constData(), static_cast<size_t>(name.size()))) {
+			::exec(conn_.get(), Sql(QByteArray("DEALLOCATE ") + id), &errorMessage_);
+			PQfreemem(id);
+		}
+	}
+
+	bool exceedsLimit(const PGresult* res) const {
+		const auto size = static_cast<int64_t>(PQresultMemorySize(res));
+		return memory_->exceeds(size) || PgMemoryAccount::process().exceeds(size);
+	}
+
+	PgResult execLimited(const Sql& sql_) {
+		PGconn* conn = conn_.get();
+		PgExecTrace trace(conn, &sql_, nullptr, &sql_.params());
+		if (!::send(conn, sql_, &errorMessage_)) {
+			return PgResult();
+		}
+		if (!PQsetSingleRowMode(conn)) {
+			qWarning() << "error PQsetSingleRowMode";
+		}
+
+		PgHandle<PGresult> rows;
+		PgHandle<PGresult> streamed;
+		QString error;
+		bool streaming = false;
+		bool cancelled = false;
+
+		for (;;) {
+			auto chunk = makePgHandle(PQgetResult(conn));
+			if (!chunk) {
+				break;
+			}
+			const auto status = PQresultStatus(chunk.get());
+			if (isLastResult(conn, chunk.get())) {
+				if (error.isEmpty()) {
+					const char* message = PQresultErrorMessage(chunk.get());
+					error = QString("PGresult - ") + QString(*message ? message : PQresStatus(status));
+				}
+				break;
+			}
+			if (cancelled && status != PGRES_FATAL_ERROR) {
+				continue;
+			}
+
+			if (status == PGRES_SINGLE_TUPLE) {
+				if (streaming) {
+					PgSpan span(PgEventKind::Chunk, conn, chunk.get());
+					if (!overflow_(PgResult(std::move(chunk)))) {
+						::cancel(conn);
+						cancelled = true;
+					}
+					continue;
+				}
+				if (!rows) {
+					rows = makePgHandle(PQcopyResult(chunk.get(), PG_COPYRES_ATTRS));
+				}
+				const int row = PQntuples(rows.get());
+				for (int column = 0, n = PQnfields(chunk.get()); column < n; ++column) {
+					const bool isNull = PQgetisnull(chunk.get(), 0, column) != 0;
+					PQsetvalue(rows.get(), row, column,
+						isNull ? nullptr : PQgetvalue(chunk.get(), 0, column),
+						isNull ? -1 : PQgetlength(chunk.get(), 0, column));
+				}
+				if (exceedsLimit(rows.get())) {
+					if (overflow_) {
+						streaming = true;
+						PgSpan span(PgEventKind::Chunk, conn, rows.get());
+						if (!overflow_(PgResult(std::move(rows)))) {
+							::cancel(conn);
+							cancelled = true;
+						}
+					} else {
+						error = "PgResult - memory limit exceeded";
+						::cancel(conn);
+						cancelled = true;
+					}
+				}
+			} else if (status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK) {
+				if (streaming) {
+					streamed = std::move(chunk);
+				} else if (!rows) {
+					rows = std::move(chunk);
+				}
+			} else if (error.isEmpty()) {
+				error = QString("PGresult - ") + QString(PQresultErrorMessage(chunk.get()));
+			}
+		}
+
+		// the query may have finished before the cancel reached the server
+		if (cancelled && error.isEmpty()) {
+			error = "PgResult - cancelled by the overflow handler";
+		}
+		if (!error.isEmpty()) {
+			qWarning() << error;
+			errorMessage_ = error;
+			return PgResult();
+		}
+
+		PgResult res = streaming ? PgResult() : PgResult(std::move(rows));
+		trace.done(streaming ? streamed.get() : res.get());
+		return res;
+	}
+
 private:
+	struct PreparedStatement {
+		QByteArray command;
+		bool prepared;
+	};
+
 	PgHandle<PGconn> conn_;
 	QString errorMessage_;
+	std::shared_ptr<PgMemoryAccount> memory_;
+	std::function<bool(PgResult&&)> overflow_;
+	PgReconnectPolicy reconnect_;
+	std::vector<Sql> session_;
+	std::map<QByteArray, PreparedStatement> prepared_;
 };
 
+#ifdef T_PG_ALLOC_TRACKING_IMPLEMENTATION
+#include <cstdlib>
+#include <new>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+namespace pg_alloc {
+
+inline void count(std::size_t size) {
+	PgAllocCounters& counters = pgThreadAllocations();
+	++counters.allocations;
+	counters.bytes += size;
+}
+
+static const bool linked = (pgAllocTrackingStorage() = true);
+
+} // namespace pg_alloc
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+void* __libc_memalign(size_t align, size_t size);
+
+void* malloc(size_t size) {
+	pg_alloc::count(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+	pg_alloc::count(n * size);
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) {
+	pg_alloc::count(size);
+	return __libc_realloc(p, size);
+}
+
+void free(void* p) { __libc_free(p); }
+}
+#endif
+
+namespace pg_alloc {
+
+// malloc that is not counted a second time by the replacement above
+inline void* rawMalloc(std::size_t size) {
+#if defined(__GLIBC__)
+	return __libc_malloc(size);
+#else
+	return std::malloc(size);
+#endif
+}
+
+inline void* rawAligned(std::size_t size, std::size_t align) {
+#if defined(_MSC_VER)
+	return _aligned_malloc(size, align);
+#elif defined(__GLIBC__)
+	return __libc_memalign(align, size);
+#else
+	void* p = nullptr;
+	return (posix_memalign(&p, align, size) == 0) ? p : nullptr;
+#endif
+}
+
+inline void freeAligned(void* p) {
+#if defined(_MSC_VER)
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+// the standard operator new loop: call the new_handler until it frees memory or gives up
+template<class Alloc>
+inline void* allocate(std::size_t size, Alloc alloc) {
+	if (size == 0U) {
+		size = 1U;
+	}
+	for (;;) {
+		if (void* p = alloc(size)) {
+			count(size);
+			return p;
+		}
+		std::new_handler handler = std::get_new_handler();
+		if (!handler) {
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+}
+
+template<class Alloc>
+inline void* allocateNothrow(std::size_t size, Alloc alloc) noexcept {
+	try {
+		return allocate(size, alloc);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+} // namespace pg_alloc
+
+void* operator new(std::size_t size) { return pg_alloc::allocate(size, pg_alloc::rawMalloc); }
+void* operator new[](std::size_t size) { return pg_alloc::allocate(size, pg_alloc::rawMalloc); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return pg_alloc::allocateNothrow(size, pg_alloc::rawMalloc); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return pg_alloc::allocateNothrow(size, pg_alloc::rawMalloc); }
+
+void* operator new(std::size_t size, std::align_val_t align) {
+	return pg_alloc::allocate(size, [align](std::size_t n) { return pg_alloc::rawAligned(n, static_cast<std::size_t>(align)); });
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) { return ::operator new(size, align); }
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+	return pg_alloc::allocateNothrow(size, [align](std::size_t n) { return pg_alloc::rawAligned(n, static_cast<std::size_t>(align)); });
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+	return ::operator new(size, align, std::nothrow);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { pg_alloc::freeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { pg_alloc::freeAligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { pg_alloc::freeAligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { pg_alloc::freeAligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { pg_alloc::freeAligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { pg_alloc::freeAligned(p); }
+#endif
+
 #endif
@@ -0,0 +1,377 @@
+#ifndef T_PG_ARROW_H
+#define T_PG_ARROW_H
+
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "t_pg.h"
+
+// Arrow C Data Interface, https://arrow.apache.org/docs/format/CDataInterface.html
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	const char* format;
+	const char* name;
+	const char* metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema** children;
+	struct ArrowSchema* dictionary;
+	void (*release)(struct ArrowSchema*);
+	void* private_data;
+};
+
+struct ArrowArray {
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void** buffers;
+	struct ArrowArray** children;
+	struct ArrowArray* dictionary;
+	void (*release)(struct ArrowArray*);
+	void* private_data;
+};
+
+#endif
+
+namespace pg_arrow {
+
+// pg_type.oid of the types with a native Arrow layout
+enum TypeOid : ::Oid {
+	BoolOid = 16,
+	ByteaOid = 17,
+	NameOid = 19,
+	Int8Oid = 20,
+	Int2Oid = 21,
+	Int4Oid = 23,
+	TextOid = 25,
+	OidOid = 26,
+	JsonOid = 114,
+	Float4Oid = 700,
+	Float8Oid = 701,
+	BpcharOid = 1042,
+	VarcharOid = 1043,
+	DateOid = 1082,
+	TimestampOid = 1114,
+	TimestamptzOid = 1184,
+	UuidOid = 2950,
+	JsonbOid = 3802
+};
+
+// postgres epoch 2000-01-01 relative to unix epoch
+static const int64_t kPgEpochMicros = 946684800000000LL;
+static const int32_t kPgEpochDays = 10957;
+
+enum class Layout { Bool, Fixed, Utf8, Binary };
+
+struct ColumnType {
+	const char* format;
+	Layout layout;
+	int width;
+};
+
+inline ColumnType columnType(::Oid type) {
+	switch (type) {
+	case BoolOid: return { "b", Layout::Bool, 1 };
+	case Int2Oid: return { "s", Layout::Fixed, 2 };
+	case Int4Oid: return { "i", Layout::Fixed, 4 };
+	case Int8Oid: return { "l", Layout::Fixed, 8 };
+	case OidOid: return { "I", Layout::Fixed, 4 };
+	case Float4Oid: return { "f", Layout::Fixed, 4 };
+	case Float8Oid: return { "g", Layout::Fixed, 8 };
+	case DateOid: return { "tdD", Layout::Fixed, 4 };
+	case TimestampOid: return { "tsu:", Layout::Fixed, 8 };
+	case TimestamptzOid: return { "tsu:UTC", Layout::Fixed, 8 };
+	case UuidOid: return { "w:16", Layout::Fixed, 16 };
+	case TextOid:
+	case NameOid:
+	case BpcharOid:
+	case VarcharOid:
+	case JsonOid: return { "u", Layout::Utf8, 0 };
+	default: return { "z", Layout::Binary, 0 };
+	}
+}
+
+template <typename T>
+inline void storeHost(T v, uint8_t* dst) {
+	memcpy(dst, &v, sizeof(v));
+}
+
+// Host order copy of a big endian binary value, shifted to the Arrow epoch.
+// false for dates and timestamps Arrow cannot hold: the ±infinity sentinels (the minimum and
+// maximum of the type) and the last few days or microseconds that overflow with the shift.
+inline bool storeFixed(::Oid type, const char* src, uint8_t* dst, int width) {
+	const uchar* in = reinterpret_cast<const uchar*>(src);
+	switch (type) {
+	case DateOid: {
+		const int32_t days = qFromBigEndian<int32_t>(in);
+		const int64_t shifted = static_cast<int64_t>(days) + kPgEpochDays;
+		if (days == std::numeric_limits<int32_t>::min() || shifted > std::numeric_limits<int32_t>::max()) {
+			return false;
+		}
+		storeHost(static_cast<int32_t>(shifted), dst);
+		return true;
+	}
+	case TimestampOid:
+	case TimestamptzOid: {
+		const int64_t micros = qFromBigEndian<int64_t>(in);
+		if (micros == std::numeric_limits<int64_t>::min() || micros > std::numeric_limits<int64_t>::max() - kPgEpochMicros) {
+			return false;
+		}
+		storeHost(micros + kPgEpochMicros, dst);
+		return true;
+	}
+	case UuidOid:
+		memcpy(dst, src, width);
+		return true;
+	default:
+		// floats go through the same unsigned swap, their bit pattern is kept
+		switch (width) {
+		case 2: storeHost(qFromBigEndian<uint16_t>(in), dst); return true;
+		case 4: storeHost(qFromBigEndian<uint32_t>(in), dst); return true;
+		case 8: storeHost(qFromBigEndian<uint64_t>(in), dst); return true;
+		default: memcpy(dst, src, width); return true;
+		}
+	}
+}
+
+struct SchemaData {
+	std::string format;
+	std::string name;
+	std::vector<ArrowSchema*> children;
+};
+
+inline void releaseSchema(ArrowSchema* schema) {
+	auto data = static_cast<SchemaData*>(schema->private_data);
+	for (auto child : data->children) {
+		if (child->release) {
+			child->release(child);
+		}
+		delete child;
+	}
+	delete data;
+	schema->release = nullptr;
+}
+
+struct ArrayData {
+	std::vector<uint8_t> validity;
+	std::vector<uint8_t> values;
+	std::vector<int32_t> offsets;
+	std::vector<const void*> buffers;
+	std::vector<ArrowArray*> children;
+};
+
+inline void releaseArray(ArrowArray* array) {
+	auto data = static_cast<ArrayData*>(array->private_data);
+	for (auto child : data->children) {
+		if (child->release) {
+			child->release(child);
+		}
+		delete child;
+	}
+	delete data;
+	array->release = nullptr;
+}
+
+inline void initSchema(ArrowSchema* schema, SchemaData* data, int64_t flags) {
+	schema->format = data->format.c_str();
+	schema->name = data->name.c_str();
+	schema->metadata = nullptr;
+	schema->flags = flags;
+	schema->n_children = static_cast<int64_t>(data->children.size());
+	schema->children = data->children.empty() ? nullptr : data->children.data();
+	schema->dictionary = nullptr;
+	schema->release = &releaseSchema;
+	schema->private_data = data;
+}
+
+// fills one column of all chunks in a single pass over the rows
+inline ArrowArray* exportColumn(const std::vector<const PGresult*>& chunks, int64_t length, int column) {
+	auto res0 = chunks.front();
+	const ::Oid type = PQftype(res0, column);
+	const ColumnType ct = columnType(type);
+
+	std::unique_ptr<ArrayData> data(new ArrayData);
+	data->validity.assign(static_cast<size_t>((length + 7) / 8), 0);
+	if (ct.layout == Layout::Bool) {
+		data->values.assign(static_cast<size_t>((length + 7) / 8), 0);
+	} else if (ct.layout == Layout::Fixed) {
+		data->values.assign(static_cast<size_t>(length * ct.width), 0);
+	} else {
+		data->offsets.reserve(static_cast<size_t>(length + 1));
+		data->offsets.push_back(0);
+	}
+
+	const bool utf8 = pgTextEncoding() == PgTextEncoding::Utf8;
+	int64_t nulls = 0;
+	int64_t i = 0;
+	for (auto res : chunks) {
+		const int n_rows = PQntuples(res);
+		for (int row = 0; row < n_rows; ++row, ++i) {
+			const bool isNull = PQgetisnull(res, row, column) != 0;
+			const char* src = isNull ? nullptr : PQgetvalue(res, row, column);
+			const int len = isNull ? 0 : PQgetlength(res, row, column);
+			if (isNull) {
+				++nulls;
+				if (ct.layout == Layout::Utf8 || ct.layout == Layout::Binary) {
+					data->offsets.push_back(data->offsets.back());
+				}
+				continue;
+			}
+			if (ct.layout == Layout::Fixed && len != ct.width) {
+				qWarning() << "ArrowArray - column" << PQfname(res, column) << "has a value of" << len
+					<< "bytes, expected" << ct.width;
+				return nullptr;
+			}
+			switch (ct.layout) {
+			case Layout::Bool:
+				if (*src) {
+					data->values[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
+				}
+				break;
+			case Layout::Fixed:
+				if (!storeFixed(type, src, &data->values[static_cast<size_t>(i * ct.width)], ct.width)) {
+					++nulls;
+					continue;
+				}
+				break;
+			case Layout::Utf8:
+				if (utf8) {
+					data->values.insert(data->values.end(), src, src + len);
+				} else {
+					const QByteArray text = ::value<QString>(res, row, column).toUtf8();
+					data->values.insert(data->values.end(), text.constData(), text.constData() + text.size());
+				}
+				data->offsets.push_back(static_cast<int32_t>(data->values.size()));
+				break;
+			case Layout::Binary:
+				data->values.insert(data->values.end(), src, src + len);
+				data->offsets.push_back(static_cast<int32_t>(data->values.size()));
+				break;
+			}
+			data->validity[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
+		}
+	}
+
+	if (data->values.size() > static_cast<size_t>(INT32_MAX)) {
+		qWarning() << "ArrowArray - column exceeds 2 GB, large offsets are not supported";
+		return nullptr;
+	}
+
+	data->buffers.push_back(nulls ? data->validity.data() : nullptr);
+	if (ct.layout == Layout::Utf8 || ct.layout == Layout::Binary) {
+		data->buffers.push_back(data->offsets.data());
+	}
+	data->buffers.push_back(data->values.data());
+
+	auto array = new ArrowArray;
+	array->length = length;
+	array->null_count = nulls;
+	array->offset = 0;
+	array->n_buffers = static_cast<int64_t>(data->buffers.size());
+	array->n_children = 0;
+	array->buffers = data->buffers.data();
+	array->children = nullptr;
+	array->dictionary = nullptr;
+	array->release = &releaseArray;
+	array->private_data = data.release();
+	return array;
+}
+
+} // namespace pg_arrow
+
+// Exports the results as one struct array with a child per column.
+// All chunks (e.g. single row mode results) must share the row description.
+// Dates and timestamps of ±infinity are exported as null; a fixed-width value of another
+// size than its type fails the export.
+// The caller owns schema and array and frees them through their release callbacks.
+//
+// ArrowSchema schema; ArrowArray array;
+// if (exportArrow(conn.exec(Sql("SELECT id, name FROM table")), &schema, &array)) { ... }
+inline bool exportArrow(const std::vector<const PGresult*>& chunks, ArrowSchema* schema, ArrowArray* array) {
+	using namespace pg_arrow;
+
+	if (!schema || !array) {
+		qWarning() << "ArrowArray - invalid output";
+		return false;
+	}
+	schema->release = nullptr;
+	array->release = nullptr;
+
+	if (chunks.empty() || !chunks.front()) {
+		qWarning() << "ArrowArray - invalid result handle";
+		return false;
+	}
+
+	auto res0 = chunks.front();
+	const int n_columns = PQnfields(res0);
+	int64_t length = 0;
+	for (auto res : chunks) {
+		if (!res || PQnfields(res) != n_columns) {
+			qWarning() << "ArrowArray - results have different row descriptions";
+			return false;
+		}
+		for (int column = 0; column < n_columns; ++column) {
+			if (PQfformat(res, column) != 1 || PQftype(res, column) != PQftype(res0, column)) {
+				qWarning() << "ArrowArray - results have different row descriptions";
+				return false;
+			}
+		}
+		length += PQntuples(res);
+	}
+
+	std::unique_ptr<ArrayData> data(new ArrayData);
+	data->buffers.push_back(nullptr);
+	ArrowArray parent;
+	for (int column = 0; column < n_columns; ++column) {
+		auto child = exportColumn(chunks, length, column);
+		if (!child) {
+			parent.private_data = data.release();
+			releaseArray(&parent);
+			return false;
+		}
+		data->children.push_back(child);
+	}
+
+	std::unique_ptr<SchemaData> schemaData(new SchemaData);
+	schemaData->format = "+s";
+	for (int column = 0; column < n_columns; ++column) {
+		auto childData = new SchemaData;
+		childData->format = columnType(PQftype(res0, column)).format;
+		childData->name = PQfname(res0, column);
+		auto child = new ArrowSchema;
+		initSchema(child, childData, ARROW_FLAG_NULLABLE);
+		schemaData->children.push_back(child);
+	}
+	initSchema(schema, schemaData.release(), 0);
+
+	array->length = length;
+	array->null_count = 0;
+	array->offset = 0;
+	array->n_buffers = 1;
+	array->n_children = n_columns;
+	array->buffers = data->buffers.data();
+	array->children = data->children.empty() ? nullptr : data->children.data();
+	array->dictionary = nullptr;
+	array->release = &releaseArray;
+	array->private_data = data.release();
+	return true;
+}
+
+inline bool exportArrow(const PgResult& res, ArrowSchema* schema, ArrowArray* array) {
+	return exportArrow(std::vector<const PGresult*>{ res.get() }, schema, array);
+}
+
+inline bool exportArrow(const std::vector<PgResult>& chunks, ArrowSchema* schema, ArrowArray* array) {
+	return exportArrow(v_convert(chunks, [](const PgResult& res) -> const PGresult* { return res.get(); }), schema, array);
+}
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef T_PG_CAPTURE_H
+#define T_PG_CAPTURE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "t_pg.h"
+
+// Workload capture: while a PgWorkloadCapture is attached, every exec in the process is appended
+// to a compact binary log with its statement, parameters as sent, timing, row count and a
+// small per-connection number. tools/pg_replay.cpp plays a log back against another server.
+// Full buffers are written by a thread of the capture, execs never wait for the disk.
+// Prepared statements are logged by name only, the log does not know their text.
+//
+// Parameters are logged as they are, so a capture of production traffic holds production data.
+//
+// PgWorkloadCapture capture("/var/tmp/workload.pgcap");
+// capture.attach();
+// ... serve traffic ...
+// // the log is complete once capture is destroyed
+//
+// Log layout, integers as LEB128 varints:
+//   "TPGCAP01"
+//   per exec: startUs durationUs connection flags rows statementSize statement
+//             paramCount { format size bytes }...
+//   startUs counts from the creation of the capture; flags: 1 ok, 2 prepared
+struct PgCaptureRecord {
+	uint64_t startUs;
+	uint64_t durationUs;
+	uint32_t connection;
+	bool ok;
+	bool prepared;
+	uint64_t rows;
+	// the command, or the name of a prepared statement
+	QByteArray statement;
+	SqlParameterList params;
+};
+
+class PgWorkloadCapture {
+public:
+	static constexpr const char* kMagic = "TPGCAP01";
+
+	// maxBytes stops the capture once the log reaches it, 0 for no limit
+	explicit PgWorkloadCapture(const QString& path, uint64_t maxBytes = 0ULL) :
+		file_(path),
+		maxBytes_(maxBytes),
+		written_(0ULL),
+		origin_(std::chrono::steady_clock::now()),
+		mutex_(),
+		buffer_(),
+		connections_(),
+		attached_(false),
+		wake_(),
+		full_(),
+		stop_(false),
+		writer_()
+	{
+		if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			qWarning() << "PgWorkloadCapture - can't open" << path << file_.errorString();
+			return;
+		}
+		buffer_.reserve(kFlushBytes * 2);
+		buffer_.append(kMagic, 8);
+		writer_ = std::thread(&PgWorkloadCapture::write, this);
+	}
+
+	~PgWorkloadCapture() {
+		detach();
+		if (writer_.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				handOff();
+				stop_ = true;
+			}
+			wake_.notify_one();
+			writer_.join();
+		}
+	}
+
+	// does nothing when the log could not be opened
+	void attach() {
+		if (!attached_ && file_.isOpen()) {
+			attached_ = PgExecObservers::instance().add(&PgWorkloadCapture::observe, this);
+		}
+	}
+
+	void detach() {
+		if (attached_) {
+			PgExecObservers::instance().remove(&PgWorkloadCapture::observe, this);
+			attached_ = false;
+		}
+	}
+
+	// true while execs are captured
+	bool valid() const { return attached_; }
+
+	// bytes of the log so far, including what is not written yet
+	uint64_t size() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return written_ + static_cast<uint64_t>(buffer_.size());
+	}
+
+	static void putVarint(QByteArray& out, uint64_t value) {
+		while (value >= 0x80U) {
+			out += static_cast<char>((value & 0x7FU) | 0x80U);
+			value >>= 7;
+		}
+		out += static_cast<char>(value);
+	}
+
+	// one exec in the log layout above; params may be null
+	static void putRecord(QByteArray& out, uint64_t startUs, uint64_t durationUs, uint32_t connection, bool ok,
+		bool prepared, uint64_t rows, const QByteArray& statement, const SqlParameterList* params)
+	{
+		putVarint(out, startUs);
+		putVarint(out, durationUs);
+		putVarint(out, connection);
+		out += static_cast<char>((ok ? 1 : 0) | (prepared ? 2 : 0));
+		putVarint(out, rows);
+		putVarint(out, static_cast<uint64_t>(statement.size()));
+		out.append(statement.constData(), statement.size());
+
+		const size_t count = params ? params->size() : 0U;
+		putVarint(out, count);
+		for (size_t i = 0; i < count; ++i) {
+			const QByteArray& value = params->params()[i];
+			out += static_cast<char>(params->formats()[i]);
+			putVarint(out, static_cast<uint64_t>(value.size()));
+			out.append(value.constData(), value.size());
+		}
+	}
+
+private:
+	PgWorkloadCapture(const PgWorkloadCapture&) = delete;
+	PgWorkloadCapture& operator = (const PgWorkloadCapture&) = delete;
+
+	static const int kFlushBytes = 1 << 16;
+
+	static void observe(const PgExecEvent& event, void* context) {
+		if (event.kind == PgEventKind::Exec) {
+			static_cast<PgWorkloadCapture*>(context)->append(event);
+		}
+	}
+
+	static uint64_t micros(std::chrono::steady_clock::duration d) {
+		return static_cast<uint64_t>(std::max<int64_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(d).count(), 0LL));
+	}
+
+	void append(const PgExecEvent& event) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (maxBytes_ && written_ + static_cast<uint64_t>(buffer_.size()) >= maxBytes_) {
+			return;
+		}
+		// a connection closed and another opened at the same address share a number
+		auto it = connections_.emplace(event.conn, static_cast<uint32_t>(connections_.size())).first;
+
+		putRecord(buffer_, micros(event.start - origin_), micros(event.end - event.start), it->second,
+			event.result != nullptr, event.sql == nullptr,
+			event.result ? static_cast<uint64_t>(PQntuples(event.result)) : 0ULL,
+			event.sql ? event.sql->command() : *event.name, event.params);
+
+		if (buffer_.size() >= kFlushBytes) {
+			handOff();
+			wake_.notify_one();
+		}
+	}
+
+	// queues buffer_ for the writer; mutex_ must be held
+	void handOff() {
+		if (!buffer_.isEmpty()) {
+			written_ += static_cast<uint64_t>(buffer_.size());
+			full_.push_back(std::move(buffer_));
+			buffer_ = QByteArray();
+			buffer_.reserve(kFlushBytes * 2);
+		}
+	}
+
+	// the writer thread: writes queued buffers in order until stop_ and the queue is empty
+	void write() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (;;) {
+			wake_.wait(lock, [this] { return stop_ || !full_.empty(); });
+			if (full_.empty()) {
+				return;
+			}
+			std::deque<QByteArray> pending;
+			pending.swap(full_);
+			lock.unlock();
+			for (const QByteArray& data : pending) {
+				if (file_.write(data) != data.size()) {
+					qWarning() << "PgWorkloadCapture - write failed" << file_.errorString();
+				}
+			}
+			file_.flush();
+			lock.lock();
+		}
+	}
+
+private:
+	QFile file_;
+	uint64_t maxBytes_;
+	uint64_t written_;
+	std::chrono::steady_clock::time_point origin_;
+	std::mutex mutex_;
+	QByteArray buffer_;
+	std::unordered_map<const PGconn*, uint32_t> connections_;
+	bool attached_;
+	// guarded by mutex_, written by writer_
+	std::condition_variable wake_;
+	std::deque<QByteArray> full_;
+	bool stop_;
+	std::thread writer_;
+};
+
+// Reads a PgWorkloadCapture log one record at a time.
+//
+// PgCaptureReader reader("workload.pgcap");
+// PgCaptureRecord record;
+// while (reader.next(record)) { ... }
+// if (!reader.error().isEmpty()) { ... }
+class PgCaptureReader {
+public:
+	explicit PgCaptureReader(const QString& path) : file_(path), buffer_(), pos_(0), error_() {
+		if (!file_.open(QIODevice::ReadOnly)) {
+			error_ = "PgCaptureReader - can't open " + path + ": " + file_.errorString();
+			qWarning() << error_;
+			return;
+		}
+		if (!fill(8) || QByteArray(buffer_.constData(), 8) != QByteArray(PgWorkloadCapture::kMagic)) {
+			error_ = "PgCaptureReader - not a capture log: " + path;
+			qWarning() << error_;
+			return;
+		}
+		pos_ = 8;
+	}
+
+	// false at the end of the log or on a damaged record, see error()
+	bool next(PgCaptureRecord& record) {
+		if (!error_.isEmpty() || !fill(1)) {
+			return false;
+		}
+		uint64_t connection = 0ULL;
+		uint64_t size = 0ULL;
+		uint64_t count = 0ULL;
+		if (!varint(record.startUs) || !varint(record.durationUs) || !varint(connection) || !bytes(1)) {
+			return damaged();
+		}
+		const uchar flags = static_cast<uchar>(buffer_[pos_ - 1]);
+		record.connection = static_cast<uint32_t>(connection);
+		record.ok = (flags & 1U) != 0U;
+		record.prepared = (flags & 2U) != 0U;
+		if (!varint(record.rows) || !length(size) || !bytes(size)) {
+			return damaged();
+		}
+		record.statement = QByteArray(buffer_.constData() + pos_ - size, static_cast<int>(size));
+
+		record.params = SqlParameterList();
+		// every parameter takes at least a format byte and a size byte
+		if (!varint(count) || count > remaining() / 2U) {
+			return damaged();
+		}
+		record.params.reserve(static_cast<size_t>(count));
+		for (uint64_t i = 0; i < count; ++i) {
+			if (!bytes(1)) {
+				return damaged();
+			}
+			const bool binary = buffer_[pos_ - 1] != 0;
+			if (!length(size) || !bytes(size)) {
+				return damaged();
+			}
+			QByteArray value(buffer_.constData() + pos_ - size, static_cast<int>(size));
+			if (binary) {
+				record.params.arg(std::move(value));
+			} else {
+				record.params.argText(std::move(value));
+			}
+		}
+		return true;
+	}
+
+	QString error() const { return error_; }
+
+private:
+	static const int kReadBytes = 1 << 20;
+	// the largest value PostgreSQL stores, so the largest one a capture can hold
+	static const uint64_t kMaxValue = 1ULL << 30;
+
+	// unread bytes, buffered or still in the file
+	uint64_t remaining() const {
+		return static_cast<uint64_t>(buffer_.size() - pos_) + static_cast<uint64_t>(std::max<qint64>(file_.size() - file_.pos(), 0));
+	}
+
+	// a size from the log; larger than what is left of the file means a damaged record
+	bool length(uint64_t& size) {
+		return varint(size) && size <= kMaxValue && size <= remaining();
+	}
+
+	// at least n unread bytes in buffer_
+	bool fill(uint64_t n) {
+		while (static_cast<uint64_t>(buffer_.size() - pos_) < n) {
+			if (file_.atEnd()) {
+				return false;
+			}
+			buffer_ = buffer_.mid(pos_) + file_.read(std::max<qint64>(kReadBytes, static_cast<qint64>(n)));
+			pos_ = 0;
+		}
+		return true;
+	}
+
+	bool bytes(uint64_t n) {
+		if (!fill(n)) {
+			return false;
+		}
+		pos_ += static_cast<int>(n);
+		return true;
+	}
+
+	bool varint(uint64_t& value) {
+		value = 0ULL;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (!bytes(1)) {
+				return false;
+			}
+			const uchar c = static_cast<uchar>(buffer_[pos_ - 1]);
+			value |= static_cast<uint64_t>(c & 0x7FU) << shift;
+			if (!(c & 0x80U)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool damaged() {
+		error_ = "PgCaptureReader - truncated or damaged record";
+		qWarning() << error_;
+		return false;
+	}
+
+private:
+	QFile file_;
+	QByteArray buffer_;
+	int pos_;
+	QString error_;
+};
+
+#endif
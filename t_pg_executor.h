@@ -0,0 +1,178 @@
+#ifndef T_PG_EXECUTOR_H
+#define T_PG_EXECUTOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "t_pg.h"
+
+// Worker threads that each own one PgConnection, opened lazily on the worker's first task.
+// A connection, its prepared statements and its libpq buffers never leave their thread, so
+// tasks need no locking around the connection. Tasks submitted with the same key run on the same
+// worker and find its state warm; tasks without a key go to the worker with the shortest queue.
+// An exception thrown by a task is rethrown by that task's future.get(). So is a failed
+// connect, as std::runtime_error with the connection's error message, or an exception from
+// setup; the worker then connects and runs setup again before its next task.
+//
+// PgAffinityExecutor executor("host=db dbname=app", 8, [](PgConnection& conn) {
+//     conn.prepare("find_user", Sql("SELECT id FROM users WHERE name = $1"));
+// });
+// auto id = executor.submit(userKey, [&](PgConnection& conn) {
+//     return conn.execPrepared("find_user", SqlParameterList().arg(name)).front().value<int64_t>(0);
+// });
+class PgAffinityExecutor {
+public:
+	using Setup = std::function<void(PgConnection&)>;
+
+	PgAffinityExecutor(const QString& conninfo, unsigned threads = std::thread::hardware_concurrency(), Setup setup = Setup()) :
+		conninfo_(conninfo),
+		setup_(std::move(setup)),
+		workers_()
+	{
+		threads = std::max(threads, 1U);
+		workers_.reserve(threads);
+		for (unsigned i = 0U; i < threads; ++i) {
+			workers_.emplace_back(new Worker);
+		}
+		for (auto& worker : workers_) {
+			Worker* w = worker.get();
+			w->thread = std::thread([this, w] { run(*w); });
+		}
+	}
+
+	// runs the queued tasks, then joins the workers
+	~PgAffinityExecutor() {
+		for (auto& worker : workers_) {
+			std::lock_guard<std::mutex> lock(worker->mutex);
+			worker->stop = true;
+			worker->wake.notify_one();
+		}
+		for (auto& worker : workers_) {
+			worker->thread.join();
+		}
+	}
+
+	unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+	// fn(PgConnection&) runs on the worker owning key % size()
+	template<class Fn>
+	auto submit(uint64_t key, Fn fn) -> std::future<decltype(fn(std::declval<PgConnection&>()))> {
+		return post(*workers_[key % workers_.size()], std::move(fn));
+	}
+
+	template<class Fn>
+	auto submit(Fn fn) -> std::future<decltype(fn(std::declval<PgConnection&>()))> {
+		Worker* best = workers_.front().get();
+		for (auto& worker : workers_) {
+			if (worker->queued.load(std::memory_order_relaxed) < best->queued.load(std::memory_order_relaxed)) {
+				best = worker.get();
+			}
+		}
+		return post(*best, std::move(fn));
+	}
+
+	// connection of the calling worker thread, nullptr outside a task
+	static PgConnection* current() { return currentConnection(); }
+
+private:
+	PgAffinityExecutor(const PgAffinityExecutor&) = delete;
+	PgAffinityExecutor& operator = (const PgAffinityExecutor&) = delete;
+
+	struct Worker {
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<std::function<void(PgConnection&, std::exception_ptr)>> tasks;
+		std::atomic<size_t> queued{ 0U };
+		bool stop = false;
+		std::thread thread;
+	};
+
+	static PgConnection*& currentConnection() {
+		static thread_local PgConnection* conn = nullptr;
+		return conn;
+	}
+
+	// a failed setup reaches the future through the task, like an exception of fn itself
+	template<class Fn, class Result>
+	struct Guarded {
+		Fn fn;
+
+		Result operator () (PgConnection& conn, std::exception_ptr error) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			return fn(conn);
+		}
+	};
+
+	template<class Fn>
+	auto post(Worker& worker, Fn fn) -> std::future<decltype(fn(std::declval<PgConnection&>()))> {
+		using Result = decltype(fn(std::declval<PgConnection&>()));
+		auto task = std::make_shared<std::packaged_task<Result(PgConnection&, std::exception_ptr)>>(
+			Guarded<Fn, Result>{ std::move(fn) });
+		auto future = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			worker.tasks.emplace_back([task](PgConnection& conn, std::exception_ptr error) { (*task)(conn, error); });
+			worker.queued.fetch_add(1U, std::memory_order_relaxed);
+		}
+		worker.wake.notify_one();
+		return future;
+	}
+
+	void run(Worker& worker) {
+		PgConnection conn;
+		bool opened = false;
+
+		for (;;) {
+			std::function<void(PgConnection&, std::exception_ptr)> task;
+			{
+				std::unique_lock<std::mutex> lock(worker.mutex);
+				worker.wake.wait(lock, [&] { return worker.stop || !worker.tasks.empty(); });
+				if (worker.tasks.empty()) {
+					break;
+				}
+				task = std::move(worker.tasks.front());
+				worker.tasks.pop_front();
+			}
+
+			std::exception_ptr error;
+			if (!opened) {
+				try {
+					conn = PgConnection(conninfo_);
+					if (PQstatus(conn.get()) != CONNECTION_OK) {
+						throw std::runtime_error(conn.errorMessage().toStdString());
+					}
+					if (setup_) {
+						setup_(conn);
+					}
+					opened = true;
+				} catch (...) {
+					error = std::current_exception();
+				}
+			}
+
+			// packaged_task keeps what fn throws for the future; nothing may end the worker thread
+			currentConnection() = &conn;
+			try {
+				task(conn, error);
+			} catch (...) {
+				qWarning() << "PgAffinityExecutor - task failed outside its future";
+			}
+			currentConnection() = nullptr;
+			worker.queued.fetch_sub(1U, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	QString conninfo_;
+	Setup setup_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+#endif
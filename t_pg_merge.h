@@ -0,0 +1,177 @@
+#ifndef T_PG_MERGE_H
+#define T_PG_MERGE_H
+
+#include <algorithm>
+#include <limits>
+
+#include "t_pg.h"
+
+// Globally ordered row stream over the same sorted query run on several connections.
+// Every source streams in single row mode and a binary heap holds one row per source,
+// so memory stays at one row per source whatever the result sizes. A source is read
+// only when its previous row has been consumed. After limit rows, on stop() or
+// destruction the sources still running are cancelled.
+// less must match the ORDER BY of the query.
+//
+// PgOrderedMerge merge(shardConnections, Sql("SELECT id, ts FROM events ORDER BY ts LIMIT 100"),
+//     [](const PgRow& a, const PgRow& b) { return a.value<int64_t>(1) < b.value<int64_t>(1); }, 100);
+// while (merge.next()) {
+//     use(merge.row());
+// }
+class PgOrderedMerge {
+public:
+	using Less = std::function<bool(const PgRow&, const PgRow&)>;
+
+	PgOrderedMerge(const std::vector<PgConnection*>& sources, const Sql& sql_, Less less,
+		size_t limit = std::numeric_limits<size_t>::max()) :
+		sources_(),
+		heap_(),
+		less_(std::move(less)),
+		limit_(limit),
+		returned_(0U),
+		current_(kNone),
+		errorMessage_()
+	{
+		sources_.reserve(sources.size());
+		for (auto conn : sources) {
+			Source source{ conn, PgResult(), false };
+			if (!conn->validate()) {
+				// a missing source would leave a complete-looking stream without its rows
+				errorMessage_ = conn->errorMessage();
+			} else if (::send(conn->get(), sql_, &errorMessage_)) {
+				if (!PQsetSingleRowMode(conn->get())) {
+					qWarning() << "error PQsetSingleRowMode";
+				}
+				source.running = true;
+			}
+			sources_.push_back(std::move(source));
+		}
+
+		for (size_t i = 0; i < sources_.size(); ++i) {
+			if (fetch(i)) {
+				heap_.push_back(i);
+			}
+		}
+		std::make_heap(heap_.begin(), heap_.end(), after());
+	}
+
+	~PgOrderedMerge() { stop(); }
+
+	// moves to the next row in order; false at the end, after limit rows or after an error
+	bool next() {
+		// the last row wanted needs no row after it from its source
+		if (returned_ >= limit_ || !errorMessage_.isEmpty()) {
+			stop();
+			return false;
+		}
+		if (current_ != kNone) {
+			const size_t consumed = current_;
+			current_ = kNone;
+			if (fetch(consumed)) {
+				heap_.push_back(consumed);
+				std::push_heap(heap_.begin(), heap_.end(), after());
+			}
+		}
+
+		if (heap_.empty() || !errorMessage_.isEmpty()) {
+			stop();
+			return false;
+		}
+
+		std::pop_heap(heap_.begin(), heap_.end(), after());
+		current_ = heap_.back();
+		heap_.pop_back();
+		++returned_;
+		return true;
+	}
+
+	// valid until the following next()
+	PgRow row() const { return (current_ != kNone) ? sources_[current_].head.front() : PgRow(); }
+
+	// index of the connection the current row came from
+	size_t source() const { return current_; }
+
+	// cancels the sources that still have rows and drains their connections
+	void stop() {
+		for (auto& source : sources_) {
+			if (source.running) {
+				PGconn* conn = source.conn->get();
+				::cancel(conn);
+				for (;;) {
+					auto res = makePgHandle(PQgetResult(conn));
+					if (!res || isLastResult(conn, res.get())) {
+						break;
+					}
+				}
+				source.running = false;
+			}
+			source.head = PgResult();
+		}
+		heap_.clear();
+		current_ = kNone;
+	}
+
+	QString errorMessage() const { return errorMessage_; }
+
+private:
+	PgOrderedMerge(const PgOrderedMerge&) = delete;
+	PgOrderedMerge& operator = (const PgOrderedMerge&) = delete;
+
+	static constexpr size_t kNone = static_cast<size_t>(-1);
+
+	struct Source {
+		PgConnection* conn;
+		PgResult head;
+		bool running;
+	};
+
+	// heap order: the top is the source whose head comes first
+	struct After {
+		const PgOrderedMerge* merge;
+
+		bool operator () (size_t a, size_t b) const {
+			return merge->less_(merge->sources_[b].head.front(), merge->sources_[a].head.front());
+		}
+	};
+
+	After after() const { return After{ this }; }
+
+	// reads the next row of source i into its head; false once the source is exhausted
+	bool fetch(size_t i) {
+		Source& source = sources_[i];
+		source.head = PgResult();
+		while (source.running) {
+			auto res = makePgHandle(PQgetResult(source.conn->get()));
+			if (!res) {
+				source.running = false;
+				break;
+			}
+			const auto status = PQresultStatus(res.get());
+			if (status == PGRES_SINGLE_TUPLE) {
+				source.head = PgResult(std::move(res));
+				return true;
+			}
+			if (status != PGRES_TUPLES_OK && status != PGRES_COMMAND_OK && errorMessage_.isEmpty()) {
+				const char* message = PQresultErrorMessage(res.get());
+				errorMessage_ = QString("PGresult - ") + QString(*message ? message : PQresStatus(status));
+				qWarning() << errorMessage_;
+			}
+			// a COPY or a lost connection has no end of results to wait for
+			if (isLastResult(source.conn->get(), res.get())) {
+				source.running = false;
+			}
+		}
+		return false;
+	}
+
+private:
+	std::vector<Source> sources_;
+	std::vector<size_t> heap_;
+	Less less_;
+	size_t limit_;
+	size_t returned_;
+	size_t current_;
+	QString errorMessage_;
+};
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef T_PG_PARALLEL_H
+#define T_PG_PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "t_pg.h"
+
+// Fixed set of worker threads that split an index range into chunks.
+// The calling thread takes chunks as well, so a pool of N threads decodes on N + 1 cores.
+class PgDecodePool {
+public:
+	explicit PgDecodePool(unsigned threads = std::thread::hardware_concurrency()) :
+		submit_(),
+		mutex_(),
+		wake_(),
+		done_(),
+		workers_(),
+		job_(),
+		generation_(0ULL),
+		stop_(false)
+	{
+		const unsigned n = (threads > 1U) ? threads - 1U : 0U;
+		workers_.reserve(n);
+		for (unsigned i = 0U; i < n; ++i) {
+			workers_.emplace_back([this] { work(); });
+		}
+	}
+
+	~PgDecodePool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		for (auto& worker : workers_) {
+			worker.join();
+		}
+	}
+
+	unsigned size() const { return static_cast<unsigned>(workers_.size()) + 1U; }
+
+	// Calls fn(begin, end) for consecutive ranges of at most grain indexes covering [0, count).
+	// Blocks until every range is done; the first exception thrown by fn is rethrown here.
+	// Calls from several threads take turns on the pool; fn must not call forRanges itself.
+	void forRanges(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn) {
+		if (count == 0U) {
+			return;
+		}
+		grain = std::max(grain, 1U);
+		if (workers_.empty() || count <= grain) {
+			fn(0U, count);
+			return;
+		}
+
+		std::lock_guard<std::mutex> turn(submit_);
+		std::unique_lock<std::mutex> lock(mutex_);
+		job_.fn = &fn;
+		job_.count = count;
+		job_.grain = grain;
+		job_.next.store(0ULL, std::memory_order_relaxed);
+		job_.pending = static_cast<unsigned>(workers_.size());
+		job_.error = nullptr;
+		++generation_;
+		lock.unlock();
+		wake_.notify_all();
+
+		runChunks();
+
+		lock.lock();
+		done_.wait(lock, [this] { return job_.pending == 0U; });
+		job_.fn = nullptr;
+		if (job_.error) {
+			std::rethrow_exception(job_.error);
+		}
+	}
+
+private:
+	PgDecodePool(const PgDecodePool&) = delete;
+	PgDecodePool& operator = (const PgDecodePool&) = delete;
+
+	void runChunks() {
+		for (;;) {
+			// every thread overshoots count by a grain once; 64 bits keep that from wrapping
+			const uint64_t begin = job_.next.fetch_add(job_.grain, std::memory_order_relaxed);
+			if (begin >= job_.count) {
+				return;
+			}
+			const uint64_t end = std::min<uint64_t>(begin + job_.grain, job_.count);
+			try {
+				(*job_.fn)(static_cast<uint32_t>(begin), static_cast<uint32_t>(end));
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (!job_.error) {
+					job_.error = std::current_exception();
+				}
+				job_.next.store(job_.count, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void work() {
+		unsigned long long seen = 0ULL;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+				if (stop_) {
+					return;
+				}
+				seen = generation_;
+			}
+
+			runChunks();
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (--job_.pending == 0U) {
+				done_.notify_one();
+			}
+		}
+	}
+
+private:
+	struct Job {
+		const std::function<void(uint32_t, uint32_t)>* fn = nullptr;
+		uint32_t count = 0U;
+		uint32_t grain = 1U;
+		std::atomic<uint64_t> next{ 0ULL };
+		unsigned pending = 0U;
+		std::exception_ptr error;
+	};
+
+	// held by one forRanges call for the whole job
+	std::mutex submit_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	std::vector<std::thread> workers_;
+	Job job_;
+	unsigned long long generation_;
+	bool stop_;
+};
+
+// Workers get PgRow values over the read-only PGresult, never the PgResult wrapper.
+// out is resized to the row count. std::vector<bool> packs rows into shared words that
+// threads cannot write side by side; decode those into uint8_t, or use decodeColumn.
+//
+// std::vector<Item> items;
+// decodeRows(pool, res, items, [](const PgRow& row, Item& item) {
+//     item.id = row.value<int64_t>(0);
+//     item.name = row.value<QString>(1);
+// });
+template<class T, class Fn> inline
+void decodeRows(PgDecodePool& pool, const PgResult& res, std::vector<T>& out, Fn fn, uint32_t grain = 4096U) {
+	static_assert(!std::is_same<T, bool>::value, "decodeRows cannot write std::vector<bool> from several threads");
+	const auto rows = res.begin();
+	const uint32_t n_rows = res.rowCount();
+	out.resize(n_rows);
+	T* dst = out.data();
+	pool.forRanges(n_rows, grain, [rows, dst, &fn](uint32_t begin, uint32_t end) {
+		for (uint32_t row = begin; row < end; ++row) {
+			fn(rows[row], dst[row]);
+		}
+	});
+}
+
+// auto ids = std::vector<int64_t>(); decodeColumn(pool, res, 0, ids);
+// out is left empty when column is out of range.
+template<class T> inline
+void decodeColumn(PgDecodePool& pool, const PgResult& res, uint32_t column, std::vector<T>& out, uint32_t grain = 16384U) {
+	if (column >= res.columnCount()) {
+		qWarning() << "decodeColumn - column out of range";
+		out.clear();
+		return;
+	}
+	decodeRows(pool, res, out, [column](const PgRow& row, T& item) {
+		item = row.value<T>(column);
+	}, grain);
+}
+
+// bools are decoded into bytes, one per row, and packed afterwards
+inline void decodeColumn(PgDecodePool& pool, const PgResult& res, uint32_t column, std::vector<bool>& out, uint32_t grain = 16384U) {
+	if (column >= res.columnCount()) {
+		qWarning() << "decodeColumn - column out of range";
+		out.clear();
+		return;
+	}
+	std::vector<uint8_t> bytes;
+	decodeRows(pool, res, bytes, [column](const PgRow& row, uint8_t& item) {
+		item = row.value<bool>(column) ? 1U : 0U;
+	}, grain);
+	out.assign(bytes.begin(), bytes.end());
+}
+
+#endif
@@ -0,0 +1,687 @@
+#ifndef T_PG_POOL_H
+#define T_PG_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "t_pg.h"
+
+enum class PgPriority { Interactive, Batch };
+
+// Log2 buckets of microseconds, lock-free to record
+class PgWaitHistogram {
+public:
+	PgWaitHistogram() : buckets_(), count_(0ULL), sumUs_(0ULL), maxUs_(0ULL) {
+		for (auto& bucket : buckets_) {
+			bucket.store(0ULL, std::memory_order_relaxed);
+		}
+	}
+
+	void record(uint64_t us) {
+		size_t bucket = 0U;
+		while (bucket + 1U < kBuckets && (us >> bucket) > 1ULL) {
+			++bucket;
+		}
+		buckets_[bucket].fetch_add(1ULL, std::memory_order_relaxed);
+		count_.fetch_add(1ULL, std::memory_order_relaxed);
+		sumUs_.fetch_add(us, std::memory_order_relaxed);
+		uint64_t max = maxUs_.load(std::memory_order_relaxed);
+		while (us > max && !maxUs_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+	}
+
+	uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+	double meanMs() const {
+		const auto n = count();
+		return n ? sumUs_.load(std::memory_order_relaxed) / 1000.0 / n : 0.0;
+	}
+
+	double maxMs() const { return maxUs_.load(std::memory_order_relaxed) / 1000.0; }
+
+	// upper bound of the bucket holding quantile q
+	double percentileMs(double q) const {
+		const auto n = count();
+		uint64_t seen = 0ULL;
+		for (size_t bucket = 0U; bucket < kBuckets; ++bucket) {
+			seen += buckets_[bucket].load(std::memory_order_relaxed);
+			if (n && seen >= q * n) {
+				return std::min(static_cast<double>(2ULL << bucket) / 1000.0, maxMs());
+			}
+		}
+		return maxMs();
+	}
+
+private:
+	static constexpr size_t kBuckets = 40U;
+
+	std::atomic<uint64_t> buckets_[kBuckets];
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sumUs_;
+	std::atomic<uint64_t> maxUs_;
+};
+
+// Thread-safe set of PgConnection with RAII checkout.
+// Checkout and return claim slots with a compare-and-swap; the mutex is only taken
+// to sleep when every connection is busy and the pool is at maxSize.
+// The destructor waits for leases still out, so a thread must not destroy a pool while
+// holding one of its leases.
+//
+// Admission control: Batch checkouts never hold more than maxSize - reservedInteractive
+// connections and yield to waiting Interactive callers. Each class has a bounded wait
+// queue; a checkout that finds its queue full fails at once instead of waiting.
+//
+// PgPool pool(PgPool::Options("host=db dbname=app", 2, 16));
+// if (auto conn = pool.checkout()) {
+//     conn->exec(Sql("UPDATE table SET name = $1").arg(name));
+// }
+// auto report = pool.checkout(std::chrono::minutes(5), PgPriority::Batch);
+//
+// With Options::adaptive a controller thread sizes the pool between minSize and maxSize:
+// it grows while callers queue, stops growing when connects fail or connections drop,
+// and gives back one idle connection after shrinkAfter quiet intervals in a row.
+// Connections are opened on the controller thread, so checkout never waits for a handshake.
+class PgPool {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Options {
+		Options(const QString& conninfo_ = QString(), uint32_t minSize_ = 1U, uint32_t maxSize_ = 8U) :
+			conninfo(conninfo_),
+			minSize(minSize_),
+			maxSize(maxSize_) {}
+
+		QString conninfo;
+		uint32_t minSize;
+		uint32_t maxSize;
+		// idle connections above minSize are closed after idleTimeout
+		std::chrono::milliseconds idleTimeout{ std::chrono::minutes(5) };
+		// connections are reopened when checked out after maxLifetime
+		std::chrono::milliseconds maxLifetime{ std::chrono::minutes(30) };
+		std::chrono::milliseconds checkoutTimeout{ std::chrono::seconds(30) };
+		// an idle connection unused for longer is pinged with an empty query before checkout,
+		// which catches server-side disconnects the status check cannot see; 0 disables
+		std::chrono::milliseconds pingAfterIdle{ 0 };
+		// connections only Interactive checkouts may use
+		uint32_t reservedInteractive = 0U;
+		// callers allowed to wait per class; more are rejected
+		uint32_t maxQueuedInteractive = 1024U;
+		uint32_t maxQueuedBatch = 64U;
+
+		bool adaptive = false;
+		std::chrono::milliseconds adaptInterval{ std::chrono::seconds(1) };
+		// grow while checkouts wait longer than this on average
+		std::chrono::milliseconds growWait{ 5 };
+		// shrink by one after shrinkAfter intervals below this share of busy connections
+		double shrinkUtilisation = 0.5;
+		uint32_t shrinkAfter = 10U;
+		// failed connects and dropped connections per checkin above which growth stops
+		double maxErrorRate = 0.2;
+	};
+
+	struct Metrics {
+		uint32_t queued;
+		uint64_t checkouts;
+		uint64_t rejected;
+		uint64_t timeouts;
+		// wait of checkouts that had to queue
+		uint64_t waited;
+		double waitMeanMs;
+		double waitP50Ms;
+		double waitP99Ms;
+		double waitMaxMs;
+	};
+
+private:
+	enum SlotState { Empty, Idle, Busy, Opening };
+
+	struct alignas(64) Slot {
+		std::atomic<int> state{ Empty };
+		std::atomic<int64_t> lastUsed{ 0LL };
+		int64_t created = 0LL;
+		PgConnection conn;
+	};
+
+public:
+	class Lease {
+	public:
+		Lease() : pool_(nullptr), slot_(nullptr), priority_(PgPriority::Interactive), error_() {}
+
+		Lease(Lease&& lease) :
+			pool_(lease.pool_),
+			slot_(lease.slot_),
+			priority_(lease.priority_),
+			error_(std::move(lease.error_))
+		{
+			lease.pool_ = nullptr;
+			lease.slot_ = nullptr;
+		}
+
+		Lease& operator = (Lease&& lease) {
+			std::swap(pool_, lease.pool_);
+			std::swap(slot_, lease.slot_);
+			std::swap(priority_, lease.priority_);
+			std::swap(error_, lease.error_);
+			return *this;
+		}
+
+		~Lease() { release(); }
+
+		// returns the connection to the pool before the end of scope
+		void release() {
+			if (pool_ && slot_) {
+				pool_->unadmit(priority_);
+				pool_->checkin(slot_);
+			}
+			pool_ = nullptr;
+			slot_ = nullptr;
+		}
+
+		bool valid() const { return slot_ != nullptr; }
+		explicit operator bool () const { return valid(); }
+		bool operator ! () const { return !valid(); }
+
+		PgConnection* get() const { return slot_ ? &slot_->conn : nullptr; }
+		PgConnection* operator -> () const { return get(); }
+		PgConnection& operator * () const { return *get(); }
+
+		QString errorMessage() const { return error_; }
+
+	private:
+		friend class PgPool;
+
+		Lease(PgPool* pool, Slot* slot, PgPriority priority) : pool_(pool), slot_(slot), priority_(priority), error_() {}
+
+		explicit Lease(const QString& error) : pool_(nullptr), slot_(nullptr), priority_(PgPriority::Interactive), error_(error) {}
+
+		Lease(const Lease&) = delete;
+		Lease& operator = (const Lease&) = delete;
+
+	private:
+		PgPool* pool_;
+		Slot* slot_;
+		PgPriority priority_;
+		QString error_;
+	};
+
+	explicit PgPool(const Options& options) :
+		options_(options),
+		slots_(),
+		open_(0U),
+		released_(0ULL),
+		batchBusy_(0U),
+		classes_(),
+		mutex_(),
+		target_(0U),
+		waitCount_(0ULL),
+		waitUs_(0ULL),
+		checkins_(0ULL),
+		errors_(0ULL),
+		quiet_(0U),
+		controller_(),
+		controlMutex_(),
+		controlWake_(),
+		stop_(false),
+		poked_(false),
+		draining_(false),
+		drained_()
+	{
+		options_.maxSize = std::max(options_.maxSize, 1U);
+		options_.minSize = std::min(options_.minSize, options_.maxSize);
+		options_.reservedInteractive = std::min(options_.reservedInteractive, options_.maxSize - 1U);
+		target_.store(options_.minSize);
+		slots_.reset(new Slot[options_.maxSize]);
+		fill();
+		if (options_.adaptive) {
+			controller_ = std::thread([this] { control(); });
+		}
+	}
+
+	~PgPool() {
+		if (controller_.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(controlMutex_);
+				stop_ = true;
+			}
+			controlWake_.notify_one();
+			controller_.join();
+		}
+		if (busy() != 0U) {
+			qWarning() << "PgPool - destroyed with connections checked out, waiting for them";
+			draining_.store(true);
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (!drained_.wait_for(lock, std::chrono::milliseconds(100), [this] { return busy() == 0U; })) {}
+		}
+	}
+
+	// Takes an idle connection, opens a new one below maxSize, or waits up to checkoutTimeout.
+	// A connection is handed out only if it is younger than maxLifetime and its status is
+	// CONNECTION_OK, a local check without a round trip; see Options::pingAfterIdle.
+	Lease checkout(PgPriority priority = PgPriority::Interactive) {
+		return checkout(Clock::now() + options_.checkoutTimeout, priority);
+	}
+
+	Lease checkout(std::chrono::milliseconds timeout, PgPriority priority = PgPriority::Interactive) {
+		return checkout(Clock::now() + timeout, priority);
+	}
+
+	Lease checkout(Clock::time_point deadline, PgPriority priority) {
+		Class& cls = classes_[static_cast<int>(priority)];
+		const auto start = Clock::now();
+		bool queued = false;
+		for (;;) {
+			const auto seen = released_.load();
+
+			if (admit(priority)) {
+				QString error;
+				Slot* slot = tryIdle();
+				if (!slot && !options_.adaptive) {
+					slot = tryOpen(&error);
+				}
+				if (slot) {
+					cls.checkouts.fetch_add(1ULL, std::memory_order_relaxed);
+					if (queued) {
+						const auto us = static_cast<uint64_t>(
+							std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+						cls.wait.record(us);
+						waitCount_.fetch_add(1ULL, std::memory_order_relaxed);
+						waitUs_.fetch_add(us, std::memory_order_relaxed);
+						traceWait(start, slot->conn.get());
+					}
+					return Lease(this, slot, priority);
+				}
+				if (options_.adaptive && !queued) {
+					poke();
+				}
+				unadmit(priority);
+				if (!error.isEmpty()) {
+					return Lease(error);
+				}
+			}
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (!queued) {
+				if (cls.waiters.load() >= maxQueued(priority)) {
+					cls.rejected.fetch_add(1ULL, std::memory_order_relaxed);
+					return Lease(QString("PgPool - wait queue full"));
+				}
+				queued = true;
+			}
+			++cls.waiters;
+			const bool woken = cls.wake.wait_until(lock, deadline, [&] { return released_.load() != seen; });
+			--cls.waiters;
+			if (priority == PgPriority::Interactive && cls.waiters.load() == 0U) {
+				// batch callers held back by this one may go now
+				classes_[static_cast<int>(PgPriority::Batch)].wake.notify_all();
+			}
+			if (!woken) {
+				cls.timeouts.fetch_add(1ULL, std::memory_order_relaxed);
+				traceWait(start, nullptr);
+				return Lease(QString("PgPool - checkout timeout"));
+			}
+		}
+	}
+
+	Metrics metrics(PgPriority priority) const {
+		const Class& cls = classes_[static_cast<int>(priority)];
+		return Metrics{
+			cls.waiters.load(),
+			cls.checkouts.load(std::memory_order_relaxed),
+			cls.rejected.load(std::memory_order_relaxed),
+			cls.timeouts.load(std::memory_order_relaxed),
+			cls.wait.count(),
+			cls.wait.meanMs(),
+			cls.wait.percentileMs(0.5),
+			cls.wait.percentileMs(0.99),
+			cls.wait.maxMs()
+		};
+	}
+
+	// Closes idle connections past idleTimeout or maxLifetime and reopens up to targetSize().
+	// Call periodically, e.g. from a timer.
+	void maintain() {
+		const auto now = nowNs();
+		for (uint32_t i = 0U; i < options_.maxSize; ++i) {
+			Slot& slot = slots_[i];
+			int idle = Idle;
+			if (!slot.state.compare_exchange_strong(idle, Busy)) {
+				continue;
+			}
+			const bool expired = (now - slot.created) > toNs(options_.maxLifetime);
+			const bool unused = (now - slot.lastUsed.load()) > toNs(options_.idleTimeout);
+			if (expired || (unused && open_.load() > target_.load())) {
+				close(slot);
+			} else {
+				// back as it was, without counting as a checkin
+				slot.state.store(Idle, std::memory_order_release);
+				notify();
+			}
+		}
+		fill();
+	}
+
+	uint32_t maxSize() const { return options_.maxSize; }
+
+	// size the adaptive controller aims for; minSize without Options::adaptive
+	uint32_t targetSize() const { return target_.load(); }
+
+	uint32_t minSize() const { return options_.minSize; }
+
+	// open connections, idle or checked out
+	uint32_t size() const { return open_.load(); }
+
+	uint32_t busy() const {
+		uint32_t n = 0U;
+		for (uint32_t i = 0U; i < options_.maxSize; ++i) {
+			n += (slots_[i].state.load(std::memory_order_relaxed) == Busy) ? 1U : 0U;
+		}
+		return n;
+	}
+
+private:
+	PgPool(const PgPool&) = delete;
+	PgPool& operator = (const PgPool&) = delete;
+
+	static int64_t nowNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	static int64_t toNs(std::chrono::milliseconds ms) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(ms).count();
+	}
+
+	struct Class {
+		std::atomic<uint32_t> waiters{ 0U };
+		std::atomic<uint64_t> checkouts{ 0ULL };
+		std::atomic<uint64_t> rejected{ 0ULL };
+		std::atomic<uint64_t> timeouts{ 0ULL };
+		PgWaitHistogram wait;
+		std::condition_variable wake;
+	};
+
+	uint32_t maxQueued(PgPriority priority) const {
+		return (priority == PgPriority::Interactive) ? options_.maxQueuedInteractive : options_.maxQueuedBatch;
+	}
+
+	// batch stays out of the reserved connections and behind waiting interactive callers
+	bool admit(PgPriority priority) {
+		if (priority == PgPriority::Interactive) {
+			return true;
+		}
+		if (classes_[static_cast<int>(PgPriority::Interactive)].waiters.load() != 0U) {
+			return false;
+		}
+		if (batchBusy_.fetch_add(1U) >= options_.maxSize - options_.reservedInteractive) {
+			batchBusy_.fetch_sub(1U);
+			return false;
+		}
+		return true;
+	}
+
+	void unadmit(PgPriority priority) {
+		if (priority == PgPriority::Batch) {
+			batchBusy_.fetch_sub(1U);
+		}
+	}
+
+	// spreads threads over the slots so they do not all race for slot 0
+	uint32_t startIndex() const {
+		static thread_local const size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+		return static_cast<uint32_t>(hint % options_.maxSize);
+	}
+
+	bool usable(Slot& slot) const {
+		const int64_t now = nowNs();
+		if (PQstatus(slot.conn.get()) != CONNECTION_OK || (now - slot.created) > toNs(options_.maxLifetime)) {
+			return false;
+		}
+		if (options_.pingAfterIdle.count() > 0 && (now - slot.lastUsed.load()) > toNs(options_.pingAfterIdle)) {
+			auto res = makePgHandle(PQexec(slot.conn.get(), ""));
+			return PQresultStatus(res.get()) == PGRES_EMPTY_QUERY;
+		}
+		return true;
+	}
+
+	Slot* tryIdle() {
+		const uint32_t start = startIndex();
+		for (uint32_t i = 0U; i < options_.maxSize; ++i) {
+			Slot& slot = slots_[(start + i) % options_.maxSize];
+			int idle = Idle;
+			if (slot.state.load(std::memory_order_relaxed) != Idle ||
+				!slot.state.compare_exchange_strong(idle, Busy, std::memory_order_acquire)) {
+				continue;
+			}
+			if (usable(slot)) {
+				return &slot;
+			}
+			if (PQstatus(slot.conn.get()) != CONNECTION_OK) {
+				errors_.fetch_add(1ULL, std::memory_order_relaxed);
+			}
+			close(slot);
+		}
+		return nullptr;
+	}
+
+	// reserves an empty slot below maxSize in the Opening state
+	Slot* claim() {
+		if (open_.fetch_add(1U) >= options_.maxSize) {
+			open_.fetch_sub(1U);
+			return nullptr;
+		}
+		for (uint32_t i = 0U; i < options_.maxSize; ++i) {
+			Slot& slot = slots_[i];
+			int empty = Empty;
+			if (slot.state.compare_exchange_strong(empty, Opening)) {
+				return &slot;
+			}
+		}
+		open_.fetch_sub(1U);
+		return nullptr;
+	}
+
+	// moves a claimed slot to Busy, or back to Empty if conn failed
+	bool open(Slot* slot, PgConnection&& conn, QString* error) {
+		if (!conn.valid()) {
+			errors_.fetch_add(1ULL, std::memory_order_relaxed);
+			*error = conn.errorMessage();
+			slot->state.store(Empty);
+			open_.fetch_sub(1U);
+			notify();
+			return false;
+		}
+		slot->conn = std::move(conn);
+		slot->created = nowNs();
+		slot->lastUsed.store(slot->created);
+		slot->state.store(Busy, std::memory_order_release);
+		return true;
+	}
+
+	Slot* tryOpen(QString* error) {
+		Slot* slot = claim();
+		return (slot && open(slot, PgConnection(options_.conninfo), error)) ? slot : nullptr;
+	}
+
+	// all missing connections up to targetSize() handshake at once
+	void fill() {
+		std::vector<Slot*> claimed;
+		while (open_.load() < target_.load()) {
+			Slot* slot = claim();
+			if (!slot) {
+				break;
+			}
+			claimed.push_back(slot);
+		}
+		if (claimed.empty()) {
+			return;
+		}
+
+		auto conns = PgConnection::connectMany(options_.conninfo, claimed.size());
+		for (size_t i = 0; i < claimed.size(); ++i) {
+			QString error;
+			if (open(claimed[i], std::move(conns[i]), &error)) {
+				// straight to idle: an open is not a checkin for the error rate
+				toIdle(claimed[i]);
+			}
+		}
+	}
+
+	void close(Slot& slot) {
+		slot.conn = PgConnection();
+		slot.state.store(Empty);
+		open_.fetch_sub(1U);
+		notify();
+	}
+
+	// a connection left inside a transaction is rolled back, one still running a query is closed
+	void checkin(Slot* slot) {
+		checkins_.fetch_add(1ULL, std::memory_order_relaxed);
+		switch (PQtransactionStatus(slot->conn.get())) {
+		case PQTRANS_IDLE:
+			break;
+		case PQTRANS_INTRANS:
+		case PQTRANS_INERROR:
+			slot->conn.exec(Sql("ROLLBACK"));
+			break;
+		default:
+			errors_.fetch_add(1ULL, std::memory_order_relaxed);
+			close(*slot);
+			return;
+		}
+		toIdle(slot);
+	}
+
+	void toIdle(Slot* slot) {
+		slot->lastUsed.store(nowNs(), std::memory_order_relaxed);
+		slot->state.store(Idle, std::memory_order_release);
+		notify();
+	}
+
+	// wakes an interactive waiter first, a batch one otherwise
+	void notify() {
+		released_.fetch_add(1ULL);
+		if (draining_.load()) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			drained_.notify_all();
+		}
+		for (auto priority : { PgPriority::Interactive, PgPriority::Batch }) {
+			Class& cls = classes_[static_cast<int>(priority)];
+			if (cls.waiters.load() != 0U) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				cls.wake.notify_one();
+				return;
+			}
+		}
+	}
+
+	// a PoolWait span for the exec observers, conn is null when the wait timed out
+	static void traceWait(Clock::time_point start, const PGconn* conn) {
+		if (PgExecObservers::instance().active()) {
+			PgExecEvent event{ PgEventKind::PoolWait, conn, nullptr, nullptr, nullptr,
+				start, Clock::now(), nullptr, 0ULL, nullptr, 0ULL, 0ULL };
+			PgExecObservers::instance().notify(event);
+		}
+	}
+
+	// asks the controller for an early step while there is room to grow
+	void poke() {
+		if (target_.load() < options_.maxSize || open_.load() < target_.load()) {
+			{
+				std::lock_guard<std::mutex> lock(controlMutex_);
+				poked_ = true;
+			}
+			controlWake_.notify_one();
+		}
+	}
+
+	void control() {
+		std::unique_lock<std::mutex> lock(controlMutex_);
+		while (!stop_) {
+			controlWake_.wait_for(lock, options_.adaptInterval, [&] { return stop_ || poked_; });
+			if (stop_) {
+				break;
+			}
+			poked_ = false;
+			lock.unlock();
+			adapt();
+			lock.lock();
+		}
+	}
+
+	// one controller step over the counters gathered since the previous one
+	void adapt() {
+		const uint64_t waited = waitCount_.exchange(0ULL);
+		const uint64_t waitUs = waitUs_.exchange(0ULL);
+		const uint64_t checkins = checkins_.exchange(0ULL);
+		const uint64_t errors = errors_.exchange(0ULL);
+		const uint32_t queued = classes_[0].waiters.load() + classes_[1].waiters.load();
+		const uint32_t open = open_.load();
+		uint32_t target = target_.load();
+
+		const double errorRate = static_cast<double>(errors) / std::max<uint64_t>(checkins, 1ULL);
+		const bool slow = queued != 0U ||
+			(waited != 0ULL && waitUs / waited > static_cast<uint64_t>(toNs(options_.growWait) / 1000));
+
+		if (errors != 0ULL && errorRate > options_.maxErrorRate) {
+			// more connections would only add load to a server that is failing
+			target = std::max(options_.minSize, std::min(target, open));
+			quiet_ = 0U;
+		} else if (slow) {
+			target = std::min(options_.maxSize, target + std::max(queued, 1U));
+			quiet_ = 0U;
+		} else if (busy() < options_.shrinkUtilisation * open) {
+			if (++quiet_ >= options_.shrinkAfter) {
+				const uint32_t current = std::min(target, open);
+				target = std::max(options_.minSize, (current != 0U) ? current - 1U : 0U);
+				quiet_ = 0U;
+			}
+		} else {
+			quiet_ = 0U;
+		}
+		target_.store(target);
+
+		while (open_.load() > target && closeIdle()) {}
+		fill();
+	}
+
+	bool closeIdle() {
+		for (uint32_t i = 0U; i < options_.maxSize; ++i) {
+			Slot& slot = slots_[i];
+			int idle = Idle;
+			if (slot.state.compare_exchange_strong(idle, Busy)) {
+				close(slot);
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	Options options_;
+	std::unique_ptr<Slot[]> slots_;
+	std::atomic<uint32_t> open_;
+	std::atomic<unsigned long long> released_;
+	std::atomic<uint32_t> batchBusy_;
+	Class classes_[2];
+	std::mutex mutex_;
+
+	// adaptive sizing
+	std::atomic<uint32_t> target_;
+	std::atomic<uint64_t> waitCount_;
+	std::atomic<uint64_t> waitUs_;
+	std::atomic<uint64_t> checkins_;
+	std::atomic<uint64_t> errors_;
+	uint32_t quiet_;
+	std::thread controller_;
+	std::mutex controlMutex_;
+	std::condition_variable controlWake_;
+	bool stop_;
+	bool poked_;
+	// set by the destructor while it waits for leases
+	std::atomic<bool> draining_;
+	std::condition_variable drained_;
+};
+
+#endif
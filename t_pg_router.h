@@ -0,0 +1,352 @@
+#ifndef T_PG_ROUTER_H
+#define T_PG_ROUTER_H
+
+#include <chrono>
+#include <random>
+
+#include "t_pg.h"
+
+// true for statements that are safe on a hot standby: SELECT, TABLE, VALUES, SHOW and
+// WITH queries without row locks, SELECT INTO, data-modifying CTEs or sequence calls.
+// Keywords are matched as whole words outside literals, quoted identifiers and comments.
+// Functions with side effects cannot be detected, send those through execWrite.
+inline bool isReadOnly(const Sql& sql_) {
+	const QByteArray& cmd = sql_.command();
+	const char* s = cmd.constData();
+	const size_t n = static_cast<size_t>(cmd.size());
+	// the word [begin, end) is keyword in any case, or starts with it for prefix
+	auto word = [s](size_t begin, size_t end, const char* keyword, bool prefix = false) {
+		for (; *keyword; ++keyword, ++begin) {
+			if (begin == end || PgSqlLexer::lower(s[begin]) != *keyword) {
+				return false;
+			}
+		}
+		return prefix || begin == end;
+	};
+
+	bool first = true;
+	bool afterFor = false;
+	for (size_t i = 0; i < n;) {
+		const PgSqlLexer::Token token = PgSqlLexer::next(s, n, i);
+		const size_t begin = i;
+		i = token.end;
+		if (token.kind == PgSqlLexer::Space || token.kind == PgSqlLexer::Comment) {
+			continue;
+		}
+		if (token.kind != PgSqlLexer::Word) {
+			if (first) {
+				return false;
+			}
+			afterFor = false;
+			continue;
+		}
+		const size_t end = token.end;
+		if (first) {
+			if (!word(begin, end, "select") && !word(begin, end, "with") && !word(begin, end, "table") &&
+				!word(begin, end, "values") && !word(begin, end, "show")) {
+				return false;
+			}
+			first = false;
+			continue;
+		}
+		// FOR UPDATE is caught by UPDATE itself
+		if (word(begin, end, "insert") || word(begin, end, "update") || word(begin, end, "delete") ||
+			word(begin, end, "merge") || word(begin, end, "into") ||
+			word(begin, end, "nextval") || word(begin, end, "setval") ||
+			word(begin, end, "pg_advisory", true) || word(begin, end, "pg_try_advisory", true) ||
+			(afterFor && (word(begin, end, "share") || word(begin, end, "no") || word(begin, end, "key")))) {
+			return false;
+		}
+		afterFor = word(begin, end, "for");
+	}
+	return !first;
+}
+
+// Routes statements between one primary and any number of hot standbys.
+// Writes, anything inside an open transaction on the primary and reads within
+// stickyAfterWrite of the last write go to the primary. Other reads are spread over
+// the replicas, weighted by the inverse of a moving average of their latency plus replication lag.
+// Latency is that of the lag poll every lagInterval, a probe of fixed cost, so a heavy read
+// does not count against its replica. A replica whose probe stays much slower than the fastest
+// one for slowProbes polls in a row, lags more than maxLag or loses its connection is demoted
+// for demoteFor. With no usable replica, reads go to the primary.
+// Not thread-safe, like PgConnection.
+//
+// PgReplicaRouter router("port=5432 dbname=app", { "port=5433 dbname=app" });
+// router.exec(Sql("SELECT name FROM table WHERE id = $1").arg(id));   // replica
+// router.exec(Sql("UPDATE table SET name = $1").arg(name));           // primary
+class PgReplicaRouter {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Options {
+		Options() :
+			alpha(0.2),
+			demoteFactor(4.0),
+			lagWeight(0.1),
+			maxLag(std::chrono::seconds(10)),
+			demoteFor(std::chrono::seconds(30)),
+			lagInterval(std::chrono::seconds(1)),
+			stickyAfterWrite(0),
+			reconnectTimeout(std::chrono::seconds(2)),
+			slowProbes(3U) {}
+
+		// weight of the newest sample in the moving averages
+		double alpha;
+		// probe latency above demoteFactor times the fastest replica for slowProbes polls demotes
+		double demoteFactor;
+		// ms of replication lag counted as one ms of latency
+		double lagWeight;
+		std::chrono::milliseconds maxLag;
+		std::chrono::milliseconds demoteFor;
+		std::chrono::milliseconds lagInterval;
+		std::chrono::milliseconds stickyAfterWrite;
+		// longest a read or lag poll waits for broken replicas to reconnect
+		std::chrono::milliseconds reconnectTimeout;
+		uint32_t slowProbes;
+	};
+
+	struct NodeStats {
+		QString conninfo;
+		double latencyMs;
+		double lagMs;
+		bool demoted;
+		uint64_t queries;
+	};
+
+	PgReplicaRouter(const QString& primary, const std::vector<QString>& replicas, const Options& options = Options()) :
+		options_(options),
+		primary_(),
+		nodes_(),
+		random_(std::random_device()()),
+		lastWrite_(),
+		lastLag_(),
+		errorMessage_()
+	{
+		std::vector<PgHandle<PGconn>> handles;
+		handles.push_back(connectStart(primary, true));
+		for (const auto& conninfo : replicas) {
+			handles.push_back(connectStart(conninfo, true));
+		}
+		connectPoll(v_convert(handles, [](const PgHandle<PGconn>& conn) { return conn.get(); }));
+
+		primary_ = PgConnection(std::move(handles[0]));
+		nodes_.reserve(replicas.size());
+		for (size_t i = 0; i < replicas.size(); ++i) {
+			nodes_.emplace_back(replicas[i], PgConnection(std::move(handles[i + 1])));
+			// the router reconnects replicas itself, without blocking backoff inside exec
+			nodes_.back().conn.setReconnectPolicy(PgReconnectPolicy(0));
+		}
+		refreshLag();
+	}
+
+	PgResult exec(const Sql& sql_) {
+		return isReadOnly(sql_) ? execRead(sql_) : execWrite(sql_);
+	}
+
+	PgResult execWrite(const Sql& sql_) {
+		lastWrite_ = Clock::now();
+		return execPrimary(sql_);
+	}
+
+	// a read fails over to another replica or to the primary if its replica lost the connection
+	PgResult execRead(const Sql& sql_) {
+		// a broken primary reports PQTRANS_UNKNOWN, and its reads are exactly the ones to fail over
+		const PGTransactionStatusType transaction = PQtransactionStatus(primary_.get());
+		if (transaction == PQTRANS_INTRANS || transaction == PQTRANS_INERROR || transaction == PQTRANS_ACTIVE ||
+			Clock::now() - lastWrite_ < options_.stickyAfterWrite) {
+			return execPrimary(sql_);
+		}
+
+		if (Clock::now() - lastLag_ >= options_.lagInterval) {
+			refreshLag();
+		}
+
+		while (Node* node = pick()) {
+			PgResult res = node->conn.exec(sql_);
+			if (PQstatus(node->conn.get()) != CONNECTION_OK) {
+				demote(*node);
+				continue;
+			}
+
+			++node->queries;
+			errorMessage_ = node->conn.errorMessage();
+			return res;
+		}
+
+		return execPrimary(sql_);
+	}
+
+	// polls replication lag of every replica that is not demoted and samples its latency;
+	// called from execRead every lagInterval
+	void refreshLag() {
+		lastLag_ = Clock::now();
+		const Sql lag(
+			"SELECT (CASE WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+			"ELSE EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) * 1000 END)::float8");
+		reconnect(lastLag_);
+		for (auto& node : nodes_) {
+			if (node.demotedUntil > lastLag_ || PQstatus(node.conn.get()) != CONNECTION_OK) {
+				continue;
+			}
+			const auto start = Clock::now();
+			PgResult res = node.conn.exec(lag);
+			const double probeMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			if (!res || res.empty()) {
+				demote(node);
+				continue;
+			}
+			const double ms = res[0].value<double>(0);
+			node.lagMs = node.probes ? average(node.lagMs, ms) : ms;
+			if (node.lagMs > options_.maxLag.count()) {
+				demote(node);
+				continue;
+			}
+			sample(node, probeMs);
+		}
+	}
+
+	std::vector<NodeStats> stats() const {
+		std::vector<NodeStats> result;
+		const auto now = Clock::now();
+		for (const auto& node : nodes_) {
+			result.push_back({ node.conninfo, node.latencyMs, node.lagMs, node.demotedUntil > now, node.queries });
+		}
+		return result;
+	}
+
+	PgConnection& primary() { return primary_; }
+
+	QString errorMessage() const { return errorMessage_; }
+
+private:
+	PgReplicaRouter(const PgReplicaRouter&) = delete;
+	PgReplicaRouter& operator = (const PgReplicaRouter&) = delete;
+
+	struct Node {
+		Node(const QString& conninfo_, PgConnection&& conn_) :
+			conninfo(conninfo_),
+			conn(std::move(conn_)),
+			latencyMs(0.0),
+			lagMs(0.0),
+			queries(0ULL),
+			probes(0ULL),
+			slowProbes(0U),
+			demotedUntil() {}
+
+		QString conninfo;
+		PgConnection conn;
+		// moving averages over the lag polls
+		double latencyMs;
+		double lagMs;
+		uint64_t queries;
+		uint64_t probes;
+		// lag polls in a row above demoteFactor times the fastest replica
+		uint32_t slowProbes;
+		Clock::time_point demotedUntil;
+	};
+
+	double average(double avg, double value) const {
+		return avg + options_.alpha * (value - avg);
+	}
+
+	double cost(const Node& node) const {
+		return node.latencyMs + options_.lagWeight * node.lagMs + 0.01;
+	}
+
+	PgResult execPrimary(const Sql& sql_) {
+		PgResult res = primary_.exec(sql_);
+		errorMessage_ = primary_.errorMessage();
+		return res;
+	}
+
+	// Reconnects the broken replicas whose demotion is over, all handshakes at once.
+	// One that fails is demoted again, so a dead replica costs one attempt per demoteFor.
+	void reconnect(Clock::time_point now) {
+		std::vector<Node*> broken;
+		std::vector<PgHandle<PGconn>> handles;
+		for (auto& node : nodes_) {
+			if (node.demotedUntil <= now && PQstatus(node.conn.get()) != CONNECTION_OK) {
+				broken.push_back(&node);
+				handles.push_back(connectStart(node.conninfo, true));
+			}
+		}
+		if (broken.empty()) {
+			return;
+		}
+		connectPoll(v_convert(handles, [](const PgHandle<PGconn>& conn) { return conn.get(); }),
+			static_cast<int>(options_.reconnectTimeout.count()));
+		for (size_t i = 0; i < broken.size(); ++i) {
+			broken[i]->conn = PgConnection(std::move(handles[i]));
+			broken[i]->conn.setReconnectPolicy(PgReconnectPolicy(0));
+			if (PQstatus(broken[i]->conn.get()) != CONNECTION_OK) {
+				demote(*broken[i]);
+			}
+		}
+	}
+
+	// weighted random choice among replicas that are not demoted
+	Node* pick() {
+		const auto now = Clock::now();
+		reconnect(now);
+		double total = 0.0;
+		for (auto& node : nodes_) {
+			if (node.demotedUntil <= now && PQstatus(node.conn.get()) == CONNECTION_OK) {
+				total += 1.0 / cost(node);
+			}
+		}
+		if (total <= 0.0) {
+			return nullptr;
+		}
+
+		double point = std::uniform_real_distribution<double>(0.0, total)(random_);
+		Node* chosen = nullptr;
+		for (auto& node : nodes_) {
+			if (node.demotedUntil <= now && PQstatus(node.conn.get()) == CONNECTION_OK) {
+				chosen = &node;
+				point -= 1.0 / cost(node);
+				if (point <= 0.0) {
+					break;
+				}
+			}
+		}
+		return chosen;
+	}
+
+	// one slow probe only counts, slowProbes in a row demote
+	void sample(Node& node, double ms) {
+		node.latencyMs = node.probes ? average(node.latencyMs, ms) : ms;
+		++node.probes;
+
+		double fastest = node.latencyMs;
+		for (const auto& other : nodes_) {
+			if (other.probes) {
+				fastest = std::min(fastest, other.latencyMs);
+			}
+		}
+		const bool slow = nodes_.size() > 1 && node.latencyMs > options_.demoteFactor * fastest;
+		node.slowProbes = slow ? node.slowProbes + 1U : 0U;
+		if (node.slowProbes >= std::max(options_.slowProbes, 1U)) {
+			demote(node);
+		}
+	}
+
+	void demote(Node& node) {
+		qWarning() << "PgReplicaRouter - demoting" << node.conninfo;
+		node.demotedUntil = Clock::now() + options_.demoteFor;
+		// start over after the cool-down instead of carrying the bad average
+		node.probes = 0ULL;
+		node.slowProbes = 0U;
+	}
+
+private:
+	Options options_;
+	PgConnection primary_;
+	std::vector<Node> nodes_;
+	std::mt19937 random_;
+	Clock::time_point lastWrite_;
+	Clock::time_point lastLag_;
+	QString errorMessage_;
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef T_PG_SHARD_H
+#define T_PG_SHARD_H
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include "t_pg.h"
+
+// Maps shard keys to connections with a consistent hash ring, so adding a shard moves
+// only about 1/n of the keys. execAll sends a statement to every shard at once and
+// gathers the results, costing the latency of the slowest shard rather than the sum.
+// Broken shards are reconnected before a statement is sent, all handshakes at once and
+// within reconnectTimeout; a shard that fails is reported as a per-shard error and not
+// tried again for retryAfter, so a dead shard does not hold up the others. A shard that has
+// not answered execAll within statementTimeout is cancelled and reported as timed out.
+// Not thread-safe, like PgConnection.
+//
+// PgShardRouter shards(conninfos);
+// shards.exec(userId, Sql("SELECT * FROM orders WHERE user_id = $1").arg(userId));
+// auto counts = shards.execAll(Sql("SELECT count(*) FROM orders"));
+class PgShardRouter {
+public:
+	explicit PgShardRouter(const std::vector<QString>& conninfos, uint32_t pointsPerShard = 128U,
+		std::chrono::milliseconds reconnectTimeout = std::chrono::seconds(2),
+		std::chrono::milliseconds retryAfter = std::chrono::seconds(5),
+		std::chrono::milliseconds statementTimeout = std::chrono::seconds(30)) :
+		conninfos_(conninfos),
+		shards_(),
+		retryAt_(conninfos.size()),
+		errors_(conninfos.size()),
+		ring_(),
+		reconnectTimeout_(reconnectTimeout),
+		retryAfter_(retryAfter),
+		statementTimeout_(statementTimeout)
+	{
+		std::vector<PgHandle<PGconn>> handles;
+		for (const auto& conninfo : conninfos) {
+			handles.push_back(connectStart(conninfo, true));
+		}
+		connectPoll(v_convert(handles, [](const PgHandle<PGconn>& conn) { return conn.get(); }));
+		for (auto& handle : handles) {
+			shards_.emplace_back(std::move(handle));
+			// the router reconnects shards itself, without blocking backoff inside send
+			shards_.back().setReconnectPolicy(PgReconnectPolicy(0));
+		}
+
+		ring_.reserve(conninfos.size() * pointsPerShard);
+		for (uint32_t shard = 0U; shard < conninfos.size(); ++shard) {
+			for (uint32_t point = 0U; point < pointsPerShard; ++point) {
+				ring_.push_back({ mix((static_cast<uint64_t>(shard) << 32) | point), shard });
+			}
+		}
+		std::sort(ring_.begin(), ring_.end(), [](const Point& a, const Point& b) { return a.hash < b.hash; });
+	}
+
+	uint32_t size() const { return static_cast<uint32_t>(shards_.size()); }
+
+	uint32_t shardOf(uint64_t key) const {
+		if (ring_.empty()) {
+			return 0U;
+		}
+		const uint64_t hash = mix(key);
+		auto it = std::lower_bound(ring_.begin(), ring_.end(), hash, [](const Point& p, uint64_t h) { return p.hash < h; });
+		return (it == ring_.end()) ? ring_.front().shard : it->shard;
+	}
+
+	uint32_t shardOf(const QByteArray& key) const { return shardOf(hash(key)); }
+
+	PgConnection& shard(uint32_t index) { return shards_[index]; }
+
+	template<class Key>
+	PgConnection& connection(const Key& key) { return shards_[shardOf(key)]; }
+
+	template<class Key>
+	PgResult exec(const Key& key, const Sql& sql_) {
+		const uint32_t index = shardOf(key);
+		errors_[index].clear();
+		reconnect({ index });
+		return shards_[index].exec(sql_);
+	}
+
+	// Result i comes from shard i; a failed shard gives an invalid result and errorMessage(i).
+	// Each shard reports its own exec to the exec observers. statementTimeout of 0 waits
+	// for every shard without limit.
+	std::vector<PgResult> execAll(const Sql& sql_) {
+		const size_t n = shards_.size();
+		const auto deadline = std::chrono::steady_clock::now() + statementTimeout_;
+		for (auto& error : errors_) {
+			error.clear();
+		}
+		std::vector<PgResult> results(n);
+		std::vector<std::unique_ptr<PgExecTrace>> traces(n);
+		std::vector<bool> pending(n, false);
+
+		std::vector<uint32_t> all(n);
+		for (size_t i = 0; i < n; ++i) {
+			all[i] = static_cast<uint32_t>(i);
+		}
+		reconnect(all);
+
+		for (size_t i = 0; i < n; ++i) {
+			if (PgExecObservers::instance().active()) {
+				traces[i].reset(new PgExecTrace(shards_[i].get(), &sql_, nullptr, &sql_.params()));
+			}
+			pending[i] = shards_[i].send(sql_);
+			if (!pending[i]) {
+				traces[i].reset();
+			}
+		}
+
+		std::vector<PgPollFd> fds;
+		std::vector<size_t> index;
+		for (;;) {
+			fds.clear();
+			index.clear();
+			for (size_t i = 0; i < n; ++i) {
+				if (pending[i]) {
+					PgPollFd fd{};
+					fd.fd = PQsocket(shards_[i].get());
+					fd.events = POLLIN;
+					fds.push_back(fd);
+					index.push_back(i);
+				}
+			}
+			if (fds.empty()) {
+				break;
+			}
+
+			int timeoutMs = -1;
+			if (statementTimeout_.count() > 0) {
+				const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+					deadline - std::chrono::steady_clock::now()).count();
+				if (left <= 0) {
+					for (size_t i : index) {
+						shards_[i].cancelPending();
+						results[i] = PgResult();
+						traces[i].reset();
+						errors_[i] = QString("PgShardRouter - shard %1 timed out after %2 ms")
+							.arg(i).arg(statementTimeout_.count());
+						qWarning() << errors_[i];
+					}
+					break;
+				}
+				timeoutMs = static_cast<int>(left);
+			}
+			const int ready = pollSockets(fds.data(), fds.size(), timeoutMs);
+			if (ready < 0 && errno == EINTR) {
+				continue;
+			}
+			if (ready < 0) {
+				qWarning() << "PgShardRouter - poll failed";
+				// leave no shard with a statement still running
+				for (size_t i : index) {
+					shards_[i].cancelPending();
+					results[i] = PgResult();
+					traces[i].reset();
+				}
+				break;
+			}
+
+			for (size_t k = 0; k < fds.size(); ++k) {
+				if (fds[k].revents) {
+					const size_t i = index[k];
+					pending[i] = shards_[i].collect(results[i]);
+					if (!pending[i]) {
+						if (traces[i]) {
+							results[i].setStatementKey(sql_.fingerprint());
+							traces[i]->done(results[i].get());
+							traces[i].reset();
+						}
+					}
+				}
+			}
+		}
+
+		return results;
+	}
+
+	QString errorMessage(uint32_t shard) const {
+		return errors_[shard].isEmpty() ? shards_[shard].errorMessage() : errors_[shard];
+	}
+
+	// 64-bit FNV-1a, for string shard keys
+	static uint64_t hash(const QByteArray& key) {
+		uint64_t h = 14695981039346656037ULL;
+		for (char c : key) {
+			h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+		}
+		return h;
+	}
+
+private:
+	PgShardRouter(const PgShardRouter&) = delete;
+	PgShardRouter& operator = (const PgShardRouter&) = delete;
+
+	struct Point {
+		uint64_t hash;
+		uint32_t shard;
+	};
+
+	// Reconnects the broken shards among indexes whose retryAfter is over, all handshakes at once.
+	// A replacement connection gets the router's reconnect policy, not the session setup of the old one.
+	void reconnect(const std::vector<uint32_t>& indexes) {
+		const auto now = std::chrono::steady_clock::now();
+		std::vector<uint32_t> broken;
+		std::vector<PgHandle<PGconn>> handles;
+		for (uint32_t i : indexes) {
+			if (retryAt_[i] <= now && PQstatus(shards_[i].get()) != CONNECTION_OK) {
+				broken.push_back(i);
+				handles.push_back(connectStart(conninfos_[i], true));
+			}
+		}
+		if (broken.empty()) {
+			return;
+		}
+		connectPoll(v_convert(handles, [](const PgHandle<PGconn>& conn) { return conn.get(); }),
+			static_cast<int>(reconnectTimeout_.count()));
+		for (size_t k = 0; k < broken.size(); ++k) {
+			const uint32_t i = broken[k];
+			shards_[i] = PgConnection(std::move(handles[k]));
+			shards_[i].setReconnectPolicy(PgReconnectPolicy(0));
+			if (PQstatus(shards_[i].get()) != CONNECTION_OK) {
+				qWarning() << "PgShardRouter - shard" << i << "is down";
+				retryAt_[i] = now + retryAfter_;
+			}
+		}
+	}
+
+	// splitmix64 finalizer, spreads sequential keys over the ring
+	static uint64_t mix(uint64_t x) {
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+private:
+	std::vector<QString> conninfos_;
+	std::vector<PgConnection> shards_;
+	std::vector<std::chrono::steady_clock::time_point> retryAt_;
+	// errors of the last exec or execAll that are not the connection's own, such as a timeout
+	std::vector<QString> errors_;
+	std::vector<Point> ring_;
+	std::chrono::milliseconds reconnectTimeout_;
+	std::chrono::milliseconds retryAfter_;
+	std::chrono::milliseconds statementTimeout_;
+};
+
+#endif
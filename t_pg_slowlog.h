@@ -0,0 +1,305 @@
+#ifndef T_PG_SLOWLOG_H
+#define T_PG_SLOWLOG_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "t_pg_stats.h"
+
+// While attached, logs every exec in the process slower than a threshold with its fingerprint, parameters
+// (redacted per policy) and timing. With explain on, the plan of a slow statement is
+// captured with EXPLAIN (FORMAT JSON) and the same parameters on a side connection, by a
+// worker thread so the slow caller is not delayed further. EXPLAIN runs at most once per
+// explainCooldown per statement and explainPerMinute overall; EXPLAIN without ANALYZE
+// does not execute the statement.
+//
+// PgSlowQueryLog::Options options;
+// options.threshold = std::chrono::milliseconds(200);
+// options.explain = true;
+// options.explainConninfo = "host=db dbname=app";
+// PgSlowQueryLog slowLog(options);
+// slowLog.attach();
+class PgSlowQueryLog {
+public:
+	enum class Redaction {
+		// no parameters in the log
+		Omit,
+		// length of each parameter only
+		Length,
+		// text parameters as they are, binary ones in hex
+		Full
+	};
+
+	struct Entry {
+		uint64_t fingerprint;
+		QByteArray statement;
+		std::vector<QByteArray> params;
+		double ms;
+		uint64_t rows;
+		bool ok;
+		QDateTime time;
+		// EXPLAIN (FORMAT JSON) output, empty when not captured
+		QByteArray plan;
+	};
+
+	using Sink = std::function<void(const Entry&)>;
+
+	struct Options {
+		Options() :
+			threshold(std::chrono::milliseconds(500)),
+			redaction(Redaction::Length),
+			redact(),
+			sink(),
+			explain(false),
+			explainConninfo(),
+			explainCooldown(std::chrono::minutes(10)),
+			explainPerMinute(6U) {}
+
+		std::chrono::milliseconds threshold;
+		Redaction redaction;
+		// overrides redaction: (value, format) -> what is logged
+		std::function<QByteArray(const QByteArray&, int)> redact;
+		// receives each slow statement, on the executing thread or on the EXPLAIN worker;
+		// qWarning when empty
+		Sink sink;
+		bool explain;
+		QString explainConninfo;
+		std::chrono::milliseconds explainCooldown;
+		uint32_t explainPerMinute;
+	};
+
+	explicit PgSlowQueryLog(const Options& options = Options()) :
+		options_(options),
+		thresholdNs_(std::chrono::duration_cast<std::chrono::nanoseconds>(options.threshold).count()),
+		mutex_(),
+		wake_(),
+		queue_(),
+		explained_(),
+		tokens_(static_cast<double>(options.explainPerMinute)),
+		refilled_(std::chrono::steady_clock::now()),
+		stop_(false),
+		attached_(false),
+		worker_()
+	{
+		if (options_.explain) {
+			worker_ = std::thread([this] { run(); });
+		}
+	}
+
+	// statements waiting for EXPLAIN are still reported, without their plan
+	~PgSlowQueryLog() {
+		detach();
+		if (worker_.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			wake_.notify_one();
+			worker_.join();
+		}
+	}
+
+	void attach() {
+		if (!attached_) {
+			attached_ = PgExecObservers::instance().add(&PgSlowQueryLog::observe, this);
+		}
+	}
+
+	void detach() {
+		if (attached_) {
+			PgExecObservers::instance().remove(&PgSlowQueryLog::observe, this);
+			attached_ = false;
+		}
+	}
+
+	// true for statements EXPLAIN accepts, after any leading comments and parentheses
+	static bool explainable(const QByteArray& command) {
+		const char* s = command.constData();
+		const size_t n = static_cast<size_t>(command.size());
+		size_t i = 0;
+		PgSqlLexer::Token token{ PgSqlLexer::Space, 0 };
+		while (i < n) {
+			token = PgSqlLexer::next(s, n, i);
+			if (token.kind != PgSqlLexer::Space && token.kind != PgSqlLexer::Comment &&
+				!(token.kind == PgSqlLexer::Symbol && s[i] == '(')) {
+				break;
+			}
+			i = token.end;
+		}
+		if (i >= n || token.kind != PgSqlLexer::Word) {
+			return false;
+		}
+		QByteArray first(s + i, static_cast<int>(token.end - i));
+		first = first.toUpper();
+		for (const char* keyword : { "SELECT", "INSERT", "UPDATE", "DELETE", "MERGE", "VALUES", "TABLE", "WITH" }) {
+			if (first == keyword) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	PgSlowQueryLog(const PgSlowQueryLog&) = delete;
+	PgSlowQueryLog& operator = (const PgSlowQueryLog&) = delete;
+
+	struct Job {
+		Entry entry;
+		Sql sql;
+	};
+
+	// the worker's own EXPLAIN goes through ::exec as well and must not be logged again
+	static bool& onWorker() {
+		static thread_local bool worker = false;
+		return worker;
+	}
+
+	static void observe(const PgExecEvent& event, void* context) {
+		auto* log = static_cast<PgSlowQueryLog*>(context);
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(event.end - event.start).count();
+		if (event.kind != PgEventKind::Exec || ns < log->thresholdNs_ || onWorker()) {
+			return;
+		}
+		log->slow(event, ns / 1e6);
+	}
+
+	void slow(const PgExecEvent& event, double ms) {
+		Entry entry{};
+		entry.statement = event.sql ? detached(event.sql->command()) : QByteArray("EXECUTE ") + *event.name;
+		entry.fingerprint = event.key;
+		entry.ms = ms;
+		entry.rows = PgStatementStats::rowCount(event.result);
+		entry.ok = event.result != nullptr;
+		entry.time = QDateTime::currentDateTime();
+		if (event.params && options_.redaction != Redaction::Omit) {
+			const auto& values = event.params->params();
+			const auto& formats = event.params->formats();
+			for (size_t i = 0; i < values.size(); ++i) {
+				entry.params.push_back(detached(redact(values[i], (i < formats.size()) ? formats[i] : 0)));
+			}
+		}
+
+		if (event.sql && options_.explain && explainable(entry.statement) && admitExplain(entry.fingerprint)) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			Sql explain("EXPLAIN (FORMAT JSON) ");
+			explain += entry.statement;
+			const auto& values = event.sql->params().params();
+			const auto& formats = event.sql->params().formats();
+			for (size_t i = 0; i < values.size(); ++i) {
+				if (i < formats.size() && formats[i]) {
+					explain.arg(detached(values[i]));
+				} else {
+					explain.argText(detached(values[i]));
+				}
+			}
+			queue_.push_back(Job{ std::move(entry), std::move(explain) });
+			wake_.notify_one();
+			return;
+		}
+		report(entry);
+	}
+
+	// Sql(std::string) commands and value<QByteArray> parameters may point into memory the
+	// caller frees once the exec returns; anything the worker uses later is copied
+	static QByteArray detached(const QByteArray& value) {
+		return QByteArray(value.constData(), value.size());
+	}
+
+	QByteArray redact(const QByteArray& value, int format) const {
+		if (options_.redact) {
+			return options_.redact(value, format);
+		}
+		if (options_.redaction == Redaction::Full) {
+			return format ? "\\x" + value.toHex() : value;
+		}
+		return "<" + QByteArray::number(static_cast<qlonglong>(value.size())) + " bytes>";
+	}
+
+	// token bucket of explainPerMinute, plus one EXPLAIN per statement per explainCooldown;
+	// statements past their cooldown are forgotten, so explained_ holds no more than the
+	// EXPLAINs the bucket admits within one cooldown
+	bool admitExplain(uint64_t fingerprint) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto now = std::chrono::steady_clock::now();
+		const double perMinute = static_cast<double>(options_.explainPerMinute);
+		tokens_ = std::min(perMinute, tokens_ + perMinute * std::chrono::duration<double>(now - refilled_).count() / 60.0);
+		refilled_ = now;
+		if (tokens_ < 1.0 || queue_.size() >= 16U) {
+			return false;
+		}
+
+		for (auto it = explained_.begin(); it != explained_.end(); ) {
+			it = (now - it->second >= options_.explainCooldown) ? explained_.erase(it) : std::next(it);
+		}
+		if (explained_.count(fingerprint)) {
+			return false;
+		}
+		tokens_ -= 1.0;
+		explained_[fingerprint] = now;
+		return true;
+	}
+
+	void report(const Entry& entry) const {
+		if (options_.sink) {
+			options_.sink(entry);
+			return;
+		}
+		auto log = qWarning();
+		log << "slow query" << QString::number(entry.ms, 'f', 1) << "ms" << entry.statement;
+		for (const auto& param : entry.params) {
+			log << param;
+		}
+		if (!entry.plan.isEmpty()) {
+			log << entry.plan;
+		}
+	}
+
+	void run() {
+		onWorker() = true;
+		PgConnection conn;
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (;;) {
+			wake_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+			if (queue_.empty()) {
+				break;
+			}
+			Job job = std::move(queue_.front());
+			queue_.pop_front();
+			// on shutdown the rest is reported right away instead of waiting for EXPLAINs
+			const bool stopping = stop_;
+			lock.unlock();
+
+			if (!stopping) {
+				if (!conn.get() || PQstatus(conn.get()) != CONNECTION_OK) {
+					conn = PgConnection(options_.explainConninfo);
+				}
+				PgResult plan = conn.exec(job.sql);
+				if (plan.valid() && !plan.empty()) {
+					const QByteArray json = plan[0].value<QByteArray>(0);
+					job.entry.plan = QByteArray(json.constData(), json.size());
+				}
+			}
+			report(job.entry);
+
+			lock.lock();
+		}
+	}
+
+private:
+	Options options_;
+	int64_t thresholdNs_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::deque<Job> queue_;
+	std::map<uint64_t, std::chrono::steady_clock::time_point> explained_;
+	double tokens_;
+	std::chrono::steady_clock::time_point refilled_;
+	bool stop_;
+	bool attached_;
+	std::thread worker_;
+};
+
+#endif
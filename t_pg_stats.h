@@ -0,0 +1,334 @@
+#ifndef T_PG_STATS_H
+#define T_PG_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "t_pg.h"
+
+// Log-linear latency histogram: 16 sub-buckets per power of two of nanoseconds,
+// so a percentile is within 1/16 of the true value. Recording is a few relaxed increments.
+class PgLatencyHistogram {
+public:
+	static constexpr int kSubBits = 4;
+	static constexpr int kSub = 1 << kSubBits;
+	// up to 2^40 ns, about 18 minutes
+	static constexpr int kMaxExponent = 40;
+	static constexpr int kBuckets = (kMaxExponent - kSubBits + 2) * kSub;
+
+	PgLatencyHistogram() : buckets_() {
+		for (auto& bucket : buckets_) {
+			bucket.store(0U, std::memory_order_relaxed);
+		}
+	}
+
+	static int bucketOf(uint64_t ns) {
+		if (ns < static_cast<uint64_t>(kSub)) {
+			return static_cast<int>(ns);
+		}
+		int exponent = 63;
+		while (!(ns >> exponent)) {
+			--exponent;
+		}
+		if (exponent > kMaxExponent) {
+			return kBuckets - 1;
+		}
+		const int sub = static_cast<int>((ns >> (exponent - kSubBits)) & (kSub - 1));
+		return (exponent - kSubBits + 1) * kSub + sub;
+	}
+
+	// highest value that falls into bucket
+	static uint64_t upperBound(int bucket) {
+		if (bucket < kSub) {
+			return static_cast<uint64_t>(bucket);
+		}
+		const int exponent = bucket / kSub + kSubBits - 1;
+		const uint64_t sub = static_cast<uint64_t>(bucket % kSub);
+		return ((kSub + sub + 1) << (exponent - kSubBits)) - 1;
+	}
+
+	void record(uint64_t ns) {
+		buckets_[bucketOf(ns)].fetch_add(1U, std::memory_order_relaxed);
+	}
+
+	// q in [0, 1]; 0 without samples
+	uint64_t percentile(double q) const {
+		uint64_t total = 0ULL;
+		for (const auto& bucket : buckets_) {
+			total += bucket.load(std::memory_order_relaxed);
+		}
+		const uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+		uint64_t seen = 0ULL;
+		for (int i = 0; i < kBuckets; ++i) {
+			seen += buckets_[i].load(std::memory_order_relaxed);
+			if (total && seen >= std::max<uint64_t>(rank, 1ULL)) {
+				return upperBound(i);
+			}
+		}
+		return 0ULL;
+	}
+
+private:
+	std::atomic<uint32_t> buckets_[kBuckets];
+};
+
+// Per-statement latency, row and error counts for every exec in the process,
+// collected through PgExecObservers while attached, with the phase breakdown of
+// setPgPhaseTiming, the time spent in PgDecodeScopes and, with pgAllocTracking(), heap
+// allocations per exec and per decode. Statements are keyed by
+// Sql::fingerprint, so statements differing only in constants share an entry, and prepared
+// statements by their name; a key claims a slot of a
+// fixed open-addressing table once and is updated without locks afterwards. Statements
+// beyond capacity are counted in dropped().
+//
+// PgStatementStats stats;
+// stats.attach();
+// ...
+// for (const auto& s : stats.snapshot()) {
+//     qDebug() << s.statement << s.calls << s.p99Ms;
+// }
+class PgStatementStats {
+public:
+	struct Snapshot {
+		uint64_t fingerprint;
+		QByteArray statement;
+		uint64_t calls;
+		uint64_t errors;
+		uint64_t rows;
+		double totalMs;
+		double meanMs;
+		double p50Ms;
+		double p99Ms;
+		double p999Ms;
+		double maxMs;
+		// means over the execs timed with setPgPhaseTiming(true)
+		uint64_t phased;
+		double buildMs;
+		double sendMs;
+		double firstByteMs;
+		double receiveMs;
+		// mean of the PgDecodeScopes over results of this statement
+		uint64_t decodes;
+		double decodeMs;
+		// heap allocations per exec and per decode, 0 unless pgAllocTracking()
+		double allocations;
+		double allocatedBytes;
+		double decodeAllocations;
+		double decodeAllocatedBytes;
+	};
+
+	// capacity is rounded up to a power of two
+	explicit PgStatementStats(uint32_t capacity = 256U) :
+		capacity_(1U),
+		entries_(),
+		dropped_(0ULL),
+		attached_(false)
+	{
+		while (capacity_ < capacity) {
+			capacity_ <<= 1;
+		}
+		entries_.reset(new Entry[capacity_]);
+	}
+
+	~PgStatementStats() { detach(); }
+
+	void attach() {
+		if (!attached_) {
+			attached_ = PgExecObservers::instance().add(&PgStatementStats::observe, this);
+		}
+	}
+
+	void detach() {
+		if (attached_) {
+			PgExecObservers::instance().remove(&PgStatementStats::observe, this);
+			attached_ = false;
+		}
+	}
+
+	// key 0 is reserved for empty slots
+	void record(uint64_t key, const QByteArray& statement, uint64_t ns, uint64_t rows, bool ok,
+		const PgPhases* phases = nullptr, uint64_t allocations = 0ULL, uint64_t allocatedBytes = 0ULL) {
+		record(key, "", statement, ns, rows, ok, phases, allocations, allocatedBytes);
+	}
+
+	// decode time of a result of a statement recorded before
+	void recordDecode(uint64_t key, uint64_t ns, uint64_t allocations = 0ULL, uint64_t allocatedBytes = 0ULL) {
+		if (Entry* entry = find(key, nullptr, nullptr)) {
+			entry->decodes.fetch_add(1ULL, std::memory_order_relaxed);
+			entry->decodeNs.fetch_add(ns, std::memory_order_relaxed);
+			entry->decodeAllocations.fetch_add(allocations, std::memory_order_relaxed);
+			entry->decodeAllocatedBytes.fetch_add(allocatedBytes, std::memory_order_relaxed);
+		}
+	}
+
+	// statements by descending total time
+	std::vector<Snapshot> snapshot() const {
+		std::vector<Snapshot> result;
+		for (uint32_t i = 0U; i < capacity_; ++i) {
+			const Entry& entry = entries_[i];
+			if (!entry.ready.load(std::memory_order_acquire)) {
+				continue;
+			}
+			const uint64_t calls = entry.calls.load(std::memory_order_relaxed);
+			const double totalMs = entry.totalNs.load(std::memory_order_relaxed) / 1e6;
+			const uint64_t phased = entry.phased.load(std::memory_order_relaxed);
+			const uint64_t decodes = entry.decodes.load(std::memory_order_relaxed);
+			auto per = [](const std::atomic<uint64_t>& sum, uint64_t n) {
+				return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0.0;
+			};
+			auto mean = [&](const std::atomic<uint64_t>& ns, uint64_t n) { return per(ns, n) / 1e6; };
+			result.push_back(Snapshot{
+				entry.key.load(std::memory_order_relaxed),
+				entry.statement,
+				calls,
+				entry.errors.load(std::memory_order_relaxed),
+				entry.rows.load(std::memory_order_relaxed),
+				totalMs,
+				calls ? totalMs / calls : 0.0,
+				entry.latency.percentile(0.5) / 1e6,
+				entry.latency.percentile(0.99) / 1e6,
+				entry.latency.percentile(0.999) / 1e6,
+				entry.maxNs.load(std::memory_order_relaxed) / 1e6,
+				phased,
+				mean(entry.buildNs, phased),
+				mean(entry.sendNs, phased),
+				mean(entry.firstByteNs, phased),
+				mean(entry.receiveNs, phased),
+				decodes,
+				mean(entry.decodeNs, decodes),
+				per(entry.allocations, calls),
+				per(entry.allocatedBytes, calls),
+				per(entry.decodeAllocations, decodes),
+				per(entry.decodeAllocatedBytes, decodes)
+			});
+		}
+		std::sort(result.begin(), result.end(), [](const Snapshot& a, const Snapshot& b) { return a.totalMs > b.totalMs; });
+		return result;
+	}
+
+	// execs not recorded because the table was full
+	uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+	// rows returned, or affected by INSERT, UPDATE, DELETE, MERGE, COPY
+	static uint64_t rowCount(const PGresult* res) {
+		if (!res) {
+			return 0ULL;
+		}
+		if (PQresultStatus(res) == PGRES_TUPLES_OK || PQresultStatus(res) == PGRES_SINGLE_TUPLE) {
+			return static_cast<uint64_t>(PQntuples(res));
+		}
+		return strtoull(PQcmdTuples(const_cast<PGresult*>(res)), nullptr, 10);
+	}
+
+private:
+	PgStatementStats(const PgStatementStats&) = delete;
+	PgStatementStats& operator = (const PgStatementStats&) = delete;
+
+	struct Entry {
+		std::atomic<uint64_t> key{ 0ULL };
+		std::atomic<bool> ready{ false };
+		QByteArray statement;
+		std::atomic<uint64_t> calls{ 0ULL };
+		std::atomic<uint64_t> errors{ 0ULL };
+		std::atomic<uint64_t> rows{ 0ULL };
+		std::atomic<uint64_t> totalNs{ 0ULL };
+		std::atomic<uint64_t> maxNs{ 0ULL };
+		std::atomic<uint64_t> phased{ 0ULL };
+		std::atomic<uint64_t> buildNs{ 0ULL };
+		std::atomic<uint64_t> sendNs{ 0ULL };
+		std::atomic<uint64_t> firstByteNs{ 0ULL };
+		std::atomic<uint64_t> receiveNs{ 0ULL };
+		std::atomic<uint64_t> decodes{ 0ULL };
+		std::atomic<uint64_t> decodeNs{ 0ULL };
+		std::atomic<uint64_t> allocations{ 0ULL };
+		std::atomic<uint64_t> allocatedBytes{ 0ULL };
+		std::atomic<uint64_t> decodeAllocations{ 0ULL };
+		std::atomic<uint64_t> decodeAllocatedBytes{ 0ULL };
+		PgLatencyHistogram latency;
+	};
+
+	// a slot claimed by key stores prefix + statement
+	void record(uint64_t key, const char* prefix, const QByteArray& statement, uint64_t ns, uint64_t rows, bool ok,
+		const PgPhases* phases, uint64_t allocations, uint64_t allocatedBytes) {
+		Entry* entry = find(key, prefix, &statement);
+		if (!entry) {
+			dropped_.fetch_add(1ULL, std::memory_order_relaxed);
+			return;
+		}
+		entry->latency.record(ns);
+		entry->calls.fetch_add(1ULL, std::memory_order_relaxed);
+		entry->totalNs.fetch_add(ns, std::memory_order_relaxed);
+		entry->rows.fetch_add(rows, std::memory_order_relaxed);
+		entry->allocations.fetch_add(allocations, std::memory_order_relaxed);
+		entry->allocatedBytes.fetch_add(allocatedBytes, std::memory_order_relaxed);
+		if (!ok) {
+			entry->errors.fetch_add(1ULL, std::memory_order_relaxed);
+		}
+		uint64_t max = entry->maxNs.load(std::memory_order_relaxed);
+		while (ns > max && !entry->maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+		if (phases) {
+			entry->phased.fetch_add(1ULL, std::memory_order_relaxed);
+			entry->buildNs.fetch_add(phases->buildNs, std::memory_order_relaxed);
+			entry->sendNs.fetch_add(phases->sendNs, std::memory_order_relaxed);
+			entry->firstByteNs.fetch_add(phases->firstByteNs, std::memory_order_relaxed);
+			entry->receiveNs.fetch_add(phases->receiveNs, std::memory_order_relaxed);
+		}
+	}
+
+	static void observe(const PgExecEvent& event, void* context) {
+		auto* stats = static_cast<PgStatementStats*>(context);
+		const uint64_t ns = static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(event.end - event.start).count());
+		if (event.kind != PgEventKind::Exec && event.kind != PgEventKind::Decode) {
+			return;
+		}
+		if (event.kind == PgEventKind::Decode) {
+			stats->recordDecode(event.key, ns, event.allocations, event.allocatedBytes);
+		} else if (event.sql) {
+			stats->record(event.key, "", event.sql->command(), ns, rowCount(event.result), event.result != nullptr,
+				event.phases, event.allocations, event.allocatedBytes);
+		} else if (event.name) {
+			stats->record(event.key, "EXECUTE ", *event.name, ns, rowCount(event.result), event.result != nullptr,
+				event.phases, event.allocations, event.allocatedBytes);
+		}
+	}
+
+	// Linear probing; the thread that claims a slot stores a copy of prefix + statement once,
+	// as the statement may be a fromRawData view the caller frees after the exec.
+	// Without a statement an unknown key is not inserted.
+	// Slots store hash | 1, as 0 marks a free slot; probing starts from the hash itself.
+	Entry* find(uint64_t hash, const char* prefix, const QByteArray* statement) {
+		const uint64_t key = hash | 1ULL;
+		const uint32_t mask = capacity_ - 1U;
+		for (uint32_t probe = 0U; probe < capacity_; ++probe) {
+			Entry& entry = entries_[(static_cast<uint32_t>(hash) + probe) & mask];
+			uint64_t current = entry.key.load(std::memory_order_acquire);
+			if (current == key) {
+				return &entry;
+			}
+			if (current == 0ULL && !statement) {
+				return nullptr;
+			}
+			if (current == 0ULL && entry.key.compare_exchange_strong(current, key)) {
+				const int prefixSize = static_cast<int>(strlen(prefix));
+				entry.statement.reserve(prefixSize + statement->size());
+				entry.statement.append(prefix, prefixSize).append(statement->constData(), statement->size());
+				entry.ready.store(true, std::memory_order_release);
+				return &entry;
+			}
+			if (current == key) {
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	uint32_t capacity_;
+	std::unique_ptr<Entry[]> entries_;
+	std::atomic<uint64_t> dropped_;
+	bool attached_;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef T_PG_TRACE_H
+#define T_PG_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "t_pg.h"
+
+// While attached, records every exec observer span in the process (exec, decode, connect,
+// streamed chunk and pool wait) and writes them as a Chrome trace-event JSON file, which Perfetto
+// (ui.perfetto.dev) and chrome://tracing open directly. Each thread is a track; the
+// connection, row count and statement fingerprint are in the span arguments.
+//
+// PgTraceFile trace("/tmp/t_pg.json");
+// trace.attach();
+// ... run the workload ...
+// trace.write(); // also done by the destructor
+class PgTraceFile {
+public:
+	explicit PgTraceFile(const QString& path, size_t maxSpans = 1000000U) :
+		path_(path),
+		maxSpans_(maxSpans),
+		origin_(std::chrono::steady_clock::now()),
+		mutex_(),
+		spans_(),
+		threads_(),
+		dropped_(0ULL),
+		attached_(false)
+	{}
+
+	~PgTraceFile() {
+		detach();
+		write();
+	}
+
+	void attach() {
+		if (!attached_) {
+			attached_ = PgExecObservers::instance().add(&PgTraceFile::observe, this);
+		}
+	}
+
+	void detach() {
+		if (attached_) {
+			PgExecObservers::instance().remove(&PgTraceFile::observe, this);
+			attached_ = false;
+		}
+	}
+
+	// Writes the spans recorded so far, replacing the file.
+	bool write(QString* error = nullptr) {
+		std::vector<Span> spans;
+		std::vector<uint32_t> threads;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			spans = spans_;
+			threads = threads_;
+		}
+
+		QByteArray json("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"t_pg\"}}";
+		for (uint32_t tid : threads) {
+			json += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+			json += QByteArray::number(tid);
+			json += ",\"args\":{\"name\":\"thread ";
+			json += QByteArray::number(tid);
+			json += "\"}}";
+		}
+		for (const Span& span : spans) {
+			json += ",\n{\"name\":\"";
+			json += escape(span.name);
+			json += "\",\"cat\":\"";
+			json += category(span.kind);
+			json += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+			json += QByteArray::number(span.tid);
+			json += ",\"ts\":";
+			json += QByteArray::number(span.startNs / 1000.0, 'f', 3);
+			json += ",\"dur\":";
+			json += QByteArray::number(span.durationNs / 1000.0, 'f', 3);
+			json += ",\"args\":{\"conn\":\"0x";
+			json += QByteArray::number(static_cast<qulonglong>(span.conn), 16);
+			json += "\"";
+			if (span.kind == PgEventKind::Exec || span.kind == PgEventKind::Decode) {
+				json += ",\"fingerprint\":\"";
+				json += QByteArray::number(static_cast<qulonglong>(span.key), 16);
+				json += "\"";
+			}
+			if (span.kind != PgEventKind::Connect && span.kind != PgEventKind::PoolWait) {
+				json += ",\"rows\":";
+				json += QByteArray::number(static_cast<qulonglong>(span.rows));
+			}
+			json += ",\"ok\":";
+			json += span.ok ? "true" : "false";
+			json += "}}";
+		}
+		json += "\n]}\n";
+
+		QFile file(path_);
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+			const QString message = "PgTraceFile - can't write " + path_ + ": " + file.errorString();
+			qWarning() << message;
+			if (error) {
+				*error = message;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	// spans not recorded because maxSpans was reached
+	uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+	PgTraceFile(const PgTraceFile&) = delete;
+	PgTraceFile& operator = (const PgTraceFile&) = delete;
+
+	struct Span {
+		PgEventKind kind;
+		uint32_t tid;
+		uintptr_t conn;
+		int64_t startNs;
+		int64_t durationNs;
+		uint64_t key;
+		uint64_t rows;
+		bool ok;
+		QByteArray name;
+	};
+
+	// small per-thread numbers read better in the viewer than native thread ids
+	static uint32_t threadNumber() {
+		static std::atomic<uint32_t> next{ 1U };
+		static thread_local uint32_t number = next.fetch_add(1U);
+		return number;
+	}
+
+	static const char* category(PgEventKind kind) {
+		switch (kind) {
+		case PgEventKind::Exec: return "exec";
+		case PgEventKind::Decode: return "decode";
+		case PgEventKind::Connect: return "connect";
+		case PgEventKind::Chunk: return "chunk";
+		case PgEventKind::PoolWait: return "pool";
+		}
+		return "";
+	}
+
+	// Statements are cut so a trace of long generated SQL stays loadable. They are in the client
+	// encoding, so they are decoded first: the cut falls between characters and JSON gets UTF-8.
+	// Only the first 480 bytes are decoded, enough for 120 UTF-16 units in any encoding.
+	static QByteArray name(const QByteArray& command) {
+		const QString text = decodeText(command.constData(), command.size() > 480 ? 480 : static_cast<int>(command.size()));
+		int cut = 120;
+		if (text.size() > cut && text.at(cut - 1).isHighSurrogate()) {
+			--cut;
+		}
+		return text.left(cut).toUtf8();
+	}
+
+	static QByteArray escape(const QByteArray& text) {
+		QByteArray out;
+		out.reserve(text.size());
+		for (int i = 0; i < text.size(); ++i) {
+			const uchar c = static_cast<uchar>(text[i]);
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += static_cast<char>(c);
+			} else if (c == '\n') {
+				out += "\\n";
+			} else if (c == '\r') {
+				out += "\\r";
+			} else if (c == '\t') {
+				out += "\\t";
+			} else if (c < 0x20) {
+				static const char hex[] = "0123456789abcdef";
+				out += "\\u00";
+				out += hex[c >> 4];
+				out += hex[c & 0xF];
+			} else {
+				out += static_cast<char>(c);
+			}
+		}
+		return out;
+	}
+
+	static void observe(const PgExecEvent& event, void* context) {
+		auto* trace = static_cast<PgTraceFile*>(context);
+		Span span{
+			event.kind,
+			threadNumber(),
+			reinterpret_cast<uintptr_t>(event.conn),
+			std::chrono::duration_cast<std::chrono::nanoseconds>(event.start - trace->origin_).count(),
+			std::chrono::duration_cast<std::chrono::nanoseconds>(event.end - event.start).count(),
+			event.key,
+			event.result ? static_cast<uint64_t>(PQntuples(event.result)) : 0ULL,
+			event.kind == PgEventKind::Connect ?
+				(event.conn && PQstatus(event.conn) == CONNECTION_OK) :
+				(event.kind == PgEventKind::PoolWait ? event.conn != nullptr : true),
+			QByteArray()
+		};
+		if (event.kind == PgEventKind::Exec) {
+			span.name = name(event.sql ? event.sql->command() : QByteArray("EXECUTE ") + *event.name);
+			span.ok = event.result != nullptr;
+		} else {
+			span.name = category(event.kind);
+		}
+
+		std::lock_guard<std::mutex> lock(trace->mutex_);
+		if (trace->spans_.size() >= trace->maxSpans_) {
+			trace->dropped_.fetch_add(1ULL, std::memory_order_relaxed);
+			return;
+		}
+		if (std::find(trace->threads_.begin(), trace->threads_.end(), span.tid) == trace->threads_.end()) {
+			trace->threads_.push_back(span.tid);
+		}
+		trace->spans_.push_back(std::move(span));
+	}
+
+private:
+	QString path_;
+	size_t maxSpans_;
+	std::chrono::steady_clock::time_point origin_;
+	std::mutex mutex_;
+	std::vector<Span> spans_;
+	std::vector<uint32_t> threads_;
+	std::atomic<uint64_t> dropped_;
+	bool attached_;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef T_PG_WIN1251_H
+#define T_PG_WIN1251_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include <QtCore>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define T_PG_WIN1251_SSE2
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define T_PG_WIN1251_NEON
+#endif
+
+// Table-driven WIN1251 <-> UTF-16 conversion, independent of the process locale.
+// Runs of ASCII are widened or narrowed 16 bytes per step (32 with AVX2).
+namespace pg_win1251 {
+
+// UTF-16 of 0x80..0xFF; the unassigned 0x98 maps to U+0098 so that bytes round-trip
+static const char16_t kHigh[128] = {
+	0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+	0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0x0098, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+	0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+	0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+	0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+	0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+	0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+	0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+	0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+	0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+	0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+	0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+	0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+	0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F
+};
+
+inline char16_t toUtf16(uint8_t c) {
+	return (c < 0x80) ? c : kHigh[c - 0x80];
+}
+
+struct Reverse {
+	char16_t unicode;
+	uint8_t byte;
+};
+
+// kHigh sorted by code point, for the characters outside А..я
+inline const Reverse* reverseTable() {
+	struct Table {
+		Table() {
+			for (int i = 0; i < 128; ++i) {
+				entries[i] = Reverse{ kHigh[i], static_cast<uint8_t>(0x80 + i) };
+			}
+			std::sort(entries, entries + 128, [](const Reverse& a, const Reverse& b) { return a.unicode < b.unicode; });
+		}
+		Reverse entries[128];
+	};
+	static const Table table;
+	return table.entries;
+}
+
+inline char fromUtf16(char16_t c) {
+	if (c < 0x80) {
+		return static_cast<char>(c);
+	}
+	if (c >= 0x0410 && c <= 0x044F) {
+		return static_cast<char>(c - 0x0410 + 0xC0);
+	}
+	const Reverse* table = reverseTable();
+	const Reverse* it = std::lower_bound(table, table + 128, c, [](const Reverse& r, char16_t u) { return r.unicode < u; });
+	return (it != table + 128 && it->unicode == c) ? static_cast<char>(it->byte) : '?';
+}
+
+inline void decode(const uint8_t* src, int size, char16_t* dst) {
+	int i = 0;
+#if defined(T_PG_WIN1251_SSE2)
+#if defined(__AVX2__)
+	for (; i + 32 <= size; i += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		if (_mm256_movemask_epi8(v) != 0) {
+			for (int k = i; k < i + 32; ++k) {
+				dst[k] = toUtf16(src[k]);
+			}
+			continue;
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+	}
+#endif
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		if (_mm_movemask_epi8(v) != 0) {
+			for (int k = i; k < i + 16; ++k) {
+				dst[k] = toUtf16(src[k]);
+			}
+			continue;
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+#elif defined(T_PG_WIN1251_NEON)
+	for (; i + 16 <= size; i += 16) {
+		const uint8x16_t v = vld1q_u8(src + i);
+		if (vmaxvq_u8(v) >= 0x80) {
+			for (int k = i; k < i + 16; ++k) {
+				dst[k] = toUtf16(src[k]);
+			}
+			continue;
+		}
+		vst1q_u16(reinterpret_cast<uint16_t*>(dst + i), vmovl_u8(vget_low_u8(v)));
+		vst1q_u16(reinterpret_cast<uint16_t*>(dst + i + 8), vmovl_high_u8(v));
+	}
+#endif
+	for (; i < size; ++i) {
+		dst[i] = toUtf16(src[i]);
+	}
+}
+
+// returns the number of bytes written; a surrogate pair becomes a single '?'
+inline int encode(const char16_t* src, int size, char* dst) {
+	int i = 0;
+	int out = 0;
+	for (;;) {
+#if defined(T_PG_WIN1251_SSE2)
+		const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF80));
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= size; i += 16, out += 16) {
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+			const __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), high), zero);
+			if (_mm_movemask_epi8(ascii) != 0xFFFF) {
+				break;
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + out), _mm_packus_epi16(a, b));
+		}
+#elif defined(T_PG_WIN1251_NEON)
+		for (; i + 16 <= size; i += 16, out += 16) {
+			const uint16x8_t a = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+			const uint16x8_t b = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i + 8));
+			if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80) {
+				break;
+			}
+			vst1q_u8(reinterpret_cast<uint8_t*>(dst + out), vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+		}
+#endif
+		if (i >= size) {
+			return out;
+		}
+
+		// one scalar block up to the next possible ASCII run
+		const int end = std::min(i + 16, size);
+		for (; i < end; ++i) {
+			const char16_t c = src[i];
+			if (c >= 0xD800 && c <= 0xDBFF && i + 1 < size && src[i + 1] >= 0xDC00 && src[i + 1] <= 0xDFFF) {
+				++i;
+			}
+			dst[out++] = fromUtf16(c);
+		}
+	}
+}
+
+inline QString toQString(const char* data, int size) {
+	QString text(size, Qt::Uninitialized);
+	decode(reinterpret_cast<const uint8_t*>(data), size, reinterpret_cast<char16_t*>(text.data()));
+	return text;
+}
+
+inline QByteArray fromQString(const QString& text) {
+	const int size = static_cast<int>(text.size());
+	QByteArray data(size, Qt::Uninitialized);
+	data.resize(encode(reinterpret_cast<const char16_t*>(text.constData()), size, data.data()));
+	return data;
+}
+
+} // namespace pg_win1251
+
+#endif
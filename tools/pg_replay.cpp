@@ -0,0 +1,246 @@
+// Replays a PgWorkloadCapture log against a server: every captured exec is sent again with
+// its parameters at its captured offset, divided by --speed. Each captured connection is
+// replayed in order on one replay connection; prepared statements are skipped, the log
+// has only their names. Prints replay latency next to the captured one when done.
+// The log is first split into one temporary file per replay connection, each replayed by its
+// own thread, so a connection that falls behind holds back only itself.
+//
+// g++ -std=c++17 -O2 -I.. pg_replay.cpp $(pkg-config --cflags --libs Qt5Core libpq) -pthread -fPIC
+// ./a.out --log workload.pgcap --conninfo "host=localhost dbname=staging" --speed 4 --concurrency 8
+//
+// Options:
+//   --log file          capture to replay
+//   --conninfo string   server to replay against
+//   --speed x           2 replays twice as fast as captured, 0 as fast as possible (default 1)
+//   --concurrency n     replay connections, captured connection c runs on c % n
+//                       (default: one replay connection per captured connection)
+//   --map c:r,...       captured connection c runs on replay connection r, before --concurrency
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include "../t_pg_capture.h"
+#include "../t_pg_stats.h"
+
+struct Args {
+	QString log;
+	QString conninfo;
+	double speed = 1.0;
+	unsigned concurrency = 0U;
+	std::map<uint32_t, unsigned> map;
+};
+
+// one replay connection with its own thread, reading its own part of the log
+class Replayer {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	Replayer(const Args& args, const QString& part, Clock::time_point start, PgLatencyHistogram& latency,
+		PgLatencyHistogram& lag) :
+		args_(args),
+		part_(part),
+		start_(start),
+		latency_(latency),
+		lag_(lag),
+		executed_(0ULL),
+		errors_(0ULL),
+		thread_([this] { run(); }) {}
+
+	~Replayer() {
+		finish();
+	}
+
+	// waits until the whole part is replayed
+	void finish() {
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	uint64_t executed() const { return executed_; }
+	uint64_t errors() const { return errors_; }
+
+private:
+	void run() {
+		PgCaptureReader reader(part_);
+		PgConnection conn(args_.conninfo);
+		// without a first connection every record fails at once instead of in reconnect backoff
+		const bool connected = !!conn;
+		PgCaptureRecord record;
+		while (reader.next(record)) {
+			if (!connected) {
+				++executed_;
+				++errors_;
+				continue;
+			}
+			if (args_.speed > 0.0) {
+				const auto due = start_ + std::chrono::microseconds(static_cast<int64_t>(record.startUs / args_.speed));
+				std::this_thread::sleep_until(due);
+				lag_.record(static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count()));
+			}
+
+			Sql sql(std::move(record.statement));
+			const auto& values = record.params.params();
+			for (size_t i = 0; i < values.size(); ++i) {
+				if (record.params.formats()[i]) {
+					sql.arg(values[i]);
+				} else {
+					sql.argText(values[i]);
+				}
+			}
+			const auto begin = Clock::now();
+			PgResult res = conn.exec(sql);
+			latency_.record(static_cast<uint64_t>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count()));
+			++executed_;
+			if (!res.valid()) {
+				++errors_;
+			}
+		}
+	}
+
+	const Args& args_;
+	QString part_;
+	Clock::time_point start_;
+	PgLatencyHistogram& latency_;
+	PgLatencyHistogram& lag_;
+	uint64_t executed_;
+	uint64_t errors_;
+	std::thread thread_;
+};
+
+static bool parseMap(const QByteArray& value, std::map<uint32_t, unsigned>& map) {
+	for (const QByteArray& pair : value.split(',')) {
+		const int colon = pair.indexOf(':');
+		bool okFrom = false;
+		bool okTo = false;
+		const uint from = pair.left(colon).toUInt(&okFrom);
+		const uint to = pair.mid(colon + 1).toUInt(&okTo);
+		if (colon < 0 || !okFrom || !okTo) {
+			return false;
+		}
+		map[from] = to;
+	}
+	return true;
+}
+
+static void dropDebug(QtMsgType type, const QMessageLogContext&, const QString& message) {
+	if (type != QtDebugMsg) {
+		fprintf(stderr, "%s\n", qPrintable(message));
+	}
+}
+
+int main(int argc, char** argv) {
+	Args args;
+	bool usage = (argc % 2) == 0;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const QByteArray name(argv[i]);
+		const char* value = argv[i + 1];
+		if (name == "--log") {
+			args.log = value;
+		} else if (name == "--conninfo") {
+			args.conninfo = value;
+		} else if (name == "--speed") {
+			args.speed = std::max(atof(value), 0.0);
+		} else if (name == "--concurrency") {
+			args.concurrency = static_cast<unsigned>(std::max(atoi(value), 0));
+		} else if (name == "--map") {
+			usage = usage || !parseMap(value, args.map);
+		} else {
+			usage = true;
+		}
+	}
+	if (usage || args.log.isEmpty() || args.conninfo.isEmpty()) {
+		fprintf(stderr, "usage: %s --log file --conninfo string [--speed x] [--concurrency n] [--map c:r,...]\n", argv[0]);
+		return 1;
+	}
+
+	qInstallMessageHandler(dropDebug);
+
+	PgCaptureReader reader(args.log);
+	if (!reader.error().isEmpty()) {
+		return 1;
+	}
+
+	PgLatencyHistogram captured;
+	PgLatencyHistogram replayed;
+	PgLatencyHistogram lag;
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		fprintf(stderr, "cannot create a temporary directory\n");
+		return 1;
+	}
+	// the records of replay connection r, in a log of their own
+	std::map<unsigned, std::unique_ptr<QFile>> parts;
+	QByteArray encoded;
+	uint64_t records = 0ULL;
+	uint64_t skipped = 0ULL;
+	uint64_t capturedErrors = 0ULL;
+	uint64_t lastUs = 0ULL;
+
+	PgCaptureRecord record;
+	while (reader.next(record)) {
+		++records;
+		if (record.prepared) {
+			++skipped;
+			continue;
+		}
+		captured.record(record.durationUs * 1000ULL);
+		capturedErrors += record.ok ? 0U : 1U;
+		lastUs = std::max(lastUs, record.startUs + record.durationUs);
+
+		auto mapped = args.map.find(record.connection);
+		const unsigned target = (mapped != args.map.end()) ? mapped->second :
+			(args.concurrency ? record.connection % args.concurrency : record.connection);
+		auto& part = parts[target];
+		if (!part) {
+			part.reset(new QFile(dir.path() + "/" + QString::number(target)));
+			if (!part->open(QIODevice::WriteOnly) || part->write(PgWorkloadCapture::kMagic, 8) != 8) {
+				fprintf(stderr, "cannot write %s: %s\n", qPrintable(part->fileName()), qPrintable(part->errorString()));
+				return 1;
+			}
+		}
+		encoded.clear();
+		PgWorkloadCapture::putRecord(encoded, record.startUs, record.durationUs, record.connection, record.ok,
+			record.prepared, record.rows, record.statement, &record.params);
+		if (part->write(encoded) != encoded.size()) {
+			fprintf(stderr, "cannot write %s: %s\n", qPrintable(part->fileName()), qPrintable(part->errorString()));
+			return 1;
+		}
+	}
+
+	const auto start = Replayer::Clock::now();
+	std::map<unsigned, std::unique_ptr<Replayer>> replayers;
+	for (auto& part : parts) {
+		part.second->close();
+		replayers[part.first].reset(new Replayer(args, part.second->fileName(), start, replayed, lag));
+	}
+
+	uint64_t executed = 0ULL;
+	uint64_t errors = 0ULL;
+	for (auto& replayer : replayers) {
+		replayer.second->finish();
+		executed += replayer.second->executed();
+		errors += replayer.second->errors();
+	}
+	const double seconds = std::chrono::duration<double>(Replayer::Clock::now() - start).count();
+
+	auto ms = [](uint64_t ns) { return ns / 1e6; };
+	printf("records %llu, replayed %llu on %zu connections, skipped prepared %llu\n",
+		static_cast<unsigned long long>(records), static_cast<unsigned long long>(executed),
+		replayers.size(), static_cast<unsigned long long>(skipped));
+	printf("errors  captured %llu, replayed %llu\n",
+		static_cast<unsigned long long>(capturedErrors), static_cast<unsigned long long>(errors));
+	printf("time    captured %.1f s, replayed %.1f s\n", lastUs / 1e6, seconds);
+	printf("latency captured p50 %.3f ms p99 %.3f ms p999 %.3f ms\n",
+		ms(captured.percentile(0.5)), ms(captured.percentile(0.99)), ms(captured.percentile(0.999)));
+	printf("latency replayed p50 %.3f ms p99 %.3f ms p999 %.3f ms\n",
+		ms(replayed.percentile(0.5)), ms(replayed.percentile(0.99)), ms(replayed.percentile(0.999)));
+	if (args.speed > 0.0) {
+		printf("behind schedule p50 %.3f ms p99 %.3f ms\n", ms(lag.percentile(0.5)), ms(lag.percentile(0.99)));
+	}
+	return reader.error().isEmpty() ? 0 : 1;
+}